@@ -0,0 +1,73 @@
+#!/bin/sh
+
+# Build a profile-guided, LTO-optimized swm trained on a scripted Xvfb
+# session, then compare per-event latency against the plain LTO build.
+# Reports end up in pgo/; the optimized binary is left in ./swm.
+
+set -e
+
+XDISPLAY=${XDISPLAY:-:99}
+ITERATIONS=${ITERATIONS:-200}
+SWMFLAGS=${SWMFLAGS:-} # e.g. -c to profile with the compositor
+OUT=pgo
+
+XVFB=$(command -v Xvfb) # Absolute path of Xvfb
+if [ -z "$XVFB" ]; then
+	echo "pgo.sh: Xvfb is required" >&2
+	exit 1
+fi
+
+# Run swm against the workload on a fresh server; $1 receives its latency report
+session() {
+	"$XVFB" "$XDISPLAY" -screen 0 1920x1080x24 -nolisten tcp >/dev/null 2>&1 &
+	xvfb=$!
+	sleep 1
+	DISPLAY=$XDISPLAY ./swm $SWMFLAGS >/dev/null 2>"$1" &
+	wm=$!
+	sleep 1
+	DISPLAY=$XDISPLAY "$OUT/swmload" "$ITERATIONS"
+	kill -TERM $wm
+	wait $wm || true
+	kill -TERM $xvfb
+	wait $xvfb || true
+}
+
+mkdir -p $OUT
+make pgo-clean
+
+# The workload driver is built once, without instrumentation
+make clean
+make swmload
+mv swmload $OUT/swmload
+
+# Baseline: LTO release
+make clean
+make RELEASE=1 TIMING=1
+session $OUT/baseline.txt
+
+# Training run with an instrumented build; profiles land in src/*.gcda
+make clean
+make RELEASE=1 TIMING=1 PGO=gen
+session $OUT/train.txt
+
+# Rebuild from the profiles and measure again
+make clean
+make RELEASE=1 TIMING=1 PGO=use
+session $OUT/pgo.txt
+
+# Join the two reports on event name
+awk '
+	FNR == 1 { file++; next }
+	!/^[A-Za-z]/ || NF != 4 { next }
+	file == 1 { base[$1] = $3; order[n++] = $1; next }
+	{ opt[$1] = $3; count[$1] = $2 }
+	END {
+		printf "%-18s %8s %12s %12s %8s\n", "event", "count", "lto_avg_us", "pgo_avg_us", "change"
+		for (i = 0; i < n; i++) {
+			e = order[i]
+			if (!(e in opt)) continue
+			change = base[e] > 0 ? (opt[e] - base[e]) * 100 / base[e] : 0
+			printf "%-18s %8d %12.2f %12.2f %7.1f%%\n", e, count[e], base[e], opt[e], change
+		}
+	}
+' $OUT/baseline.txt $OUT/pgo.txt | tee $OUT/report.txt
@@ -0,0 +1,169 @@
+#include "audit.h"
+
+#ifdef AUDIT
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Round trips made from one call site */
+typedef struct {
+	const char *name;
+	long calls;
+	long confirmed;  /* The server's last processed serial moved during the call */
+} audit_site_t;
+
+/* A handler (by event type) or a keybinding */
+typedef struct {
+	char name[AUDIT_NAME_LEN];
+	long runs;
+	long calls;
+	long confirmed;
+	long serials;     /* Total LastKnownRequestProcessed advance while open */
+	long unaudited;   /* Runs where the serial moved without any wrapped call */
+	int nsites;
+	audit_site_t sites[AUDIT_SITES];
+} audit_ctx_t;
+
+/* An open context; keybindings nest inside their KeyPress */
+typedef struct {
+	audit_ctx_t *ctx;
+	unsigned long serial;
+	long calls;
+} audit_frame_t;
+
+static Display *dpy;
+static audit_ctx_t contexts[AUDIT_CONTEXTS + 1];  /* The extra slot takes the overflow */
+static int ncontexts = 0;
+static audit_frame_t open_ctx[AUDIT_DEPTH];
+static int depth = 0;
+static unsigned long call_serial;
+static volatile sig_atomic_t report_requested = 0;
+
+static void audit_signal(int sig) {
+	report_requested = 1;
+}
+
+void audit_init(Display *display) {
+	dpy = display;
+	strcpy(contexts[AUDIT_CONTEXTS].name, "(other)");
+	signal(SIGUSR1, audit_signal);
+}
+
+static audit_ctx_t *audit_context(const char *name) {
+	for (int i = 0; i < ncontexts; i++) {
+		if (!strcmp(contexts[i].name, name)) return &contexts[i];
+	}
+	if (ncontexts == AUDIT_CONTEXTS) return &contexts[AUDIT_CONTEXTS];
+	audit_ctx_t *ctx = &contexts[ncontexts++];
+	snprintf(ctx->name, sizeof(ctx->name), "%s", name);
+	return ctx;
+}
+
+/* Contexts nested deeper than AUDIT_DEPTH are only counted, not tracked */
+void audit_begin(const char *context) {
+	if (!dpy || depth >= AUDIT_DEPTH) {
+		depth++;
+		return;
+	}
+	audit_frame_t *f = &open_ctx[depth++];
+	f->ctx = audit_context(context);
+	f->serial = LastKnownRequestProcessed(dpy);
+	f->calls = 0;
+	f->ctx->runs++;
+}
+
+/* Keybindings are named like the config file writes them, "Mod4+Shift+d" */
+void audit_begin_key(unsigned int mod, KeySym keysym) {
+	char name[AUDIT_NAME_LEN];
+	const char *key = XKeysymToString(keysym);
+	snprintf(name, sizeof(name), "key %s%s%s%s%s",
+		(mod & Mod4Mask) ? "Mod4+" : "", (mod & Mod1Mask) ? "Mod1+" : "",
+		(mod & ControlMask) ? "Control+" : "", (mod & ShiftMask) ? "Shift+" : "",
+		key ? key : "?");
+	audit_begin(name);
+}
+
+void audit_end() {
+	if (depth == 0) return;
+	if (depth-- > AUDIT_DEPTH) return;
+
+	audit_frame_t *f = &open_ctx[depth];
+	long moved = LastKnownRequestProcessed(dpy) - f->serial;
+	f->ctx->serials += moved;
+	if (moved > 0 && f->calls == 0) f->ctx->unaudited++;
+}
+
+void audit_call_begin() {
+	if (dpy) call_serial = LastKnownRequestProcessed(dpy);
+}
+
+/* Charge a finished call to every open context. Calls outside any handler
+ * (timers, startup) go to "(idle)", where each call counts as a run. */
+void audit_call_end(const char *site) {
+	if (!dpy) return;
+	if (depth == 0) {
+		audit_begin("(idle)");
+		audit_call_end(site);
+		audit_end();
+		return;
+	}
+
+	int confirmed = LastKnownRequestProcessed(dpy) != call_serial;
+	for (int i = 0; i < depth && i < AUDIT_DEPTH; i++) {
+		audit_ctx_t *ctx = open_ctx[i].ctx;
+		audit_site_t *s = NULL;
+		open_ctx[i].calls++;
+		ctx->calls++;
+		ctx->confirmed += confirmed;
+
+		for (int j = 0; j < ctx->nsites && !s; j++) {
+			if (ctx->sites[j].name == site || !strcmp(ctx->sites[j].name, site)) s = &ctx->sites[j];
+		}
+		if (!s && ctx->nsites < AUDIT_SITES) {
+			s = &ctx->sites[ctx->nsites++];
+			s->name = site;
+		}
+		if (s) {
+			s->calls++;
+			s->confirmed += confirmed;
+		}
+	}
+}
+
+/* Print the report if SIGUSR1 asked for one; called from the main loop */
+void audit_poll() {
+	if (!report_requested) return;
+	report_requested = 0;
+	audit_report();
+}
+
+/* One line per context: runs, round trips in total and per run, how many the
+ * request serial confirmed, and runs that moved the serial with no wrapped
+ * call (an unaudited round trip, or events read while waiting) */
+void audit_report() {
+	fprintf(stderr, "%-24s %8s %8s %8s %9s %9s\n", "context", "runs", "rtrips", "per_run",
+		"confirmed", "unaudited");
+	for (int i = 0; i <= AUDIT_CONTEXTS; i++) {
+		audit_ctx_t *ctx = &contexts[i];
+		if (!ctx->runs) continue;
+		fprintf(stderr, "%-24s %8ld %8ld %8.2f %9ld %9ld\n", ctx->name, ctx->runs, ctx->calls,
+			(double)ctx->calls / ctx->runs, ctx->confirmed, ctx->unaudited);
+		for (int j = 0; j < ctx->nsites; j++) {
+			fprintf(stderr, "    %-20s %8s %8ld %8.2f %9ld\n", ctx->sites[j].name, "",
+				ctx->sites[j].calls, (double)ctx->sites[j].calls / ctx->runs, ctx->sites[j].confirmed);
+		}
+	}
+}
+
+#else
+
+void audit_init(Display *display) {}
+void audit_begin(const char *context) {}
+void audit_begin_key(unsigned int mod, KeySym keysym) {}
+void audit_end() {}
+void audit_call_begin() {}
+void audit_call_end(const char *site) {}
+void audit_poll() {}
+void audit_report() {}
+
+#endif
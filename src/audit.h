@@ -0,0 +1,33 @@
+#ifndef AUDIT_H
+#define AUDIT_H
+
+#include <X11/Xlib.h>
+
+#define AUDIT_CONTEXTS 64  /* Handlers and keybindings tracked separately */
+#define AUDIT_SITES 16     /* Call sites listed per context */
+#define AUDIT_NAME_LEN 48
+#define AUDIT_DEPTH 4      /* Contexts open at once: a handler and the binding inside it */
+
+/* Round-trip auditing (make AUDIT=1): every X call wrapped in TRACE_X is
+ * counted against each handler or keybinding open at the time. Reported on
+ * exit and on SIGUSR1. Without AUDIT the macros compile to nothing. */
+#ifdef AUDIT
+#define AUDIT_BEGIN(context) audit_begin(context)
+#define AUDIT_BEGIN_KEY(mod, keysym) audit_begin_key((mod), (keysym))
+#define AUDIT_END() audit_end()
+#else
+#define AUDIT_BEGIN(context) ((void)0)
+#define AUDIT_BEGIN_KEY(mod, keysym) ((void)0)
+#define AUDIT_END() ((void)0)
+#endif
+
+void audit_init(Display *display);
+void audit_begin(const char *context);
+void audit_begin_key(unsigned int mod, KeySym keysym);
+void audit_end();
+void audit_call_begin();
+void audit_call_end(const char *site);
+void audit_poll();
+void audit_report();
+
+#endif /* AUDIT_H */
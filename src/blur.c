@@ -0,0 +1,447 @@
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "blur.h"
+
+/*
+ * Separable box blur on 32bpp pixels. Repeated passes approximate a
+ * Gaussian. A box of at most 2 * BLUR_MAX_RADIUS + 1 bytes sums to at most
+ * 65025, so the SIMD kernels keep their running sums in 16-bit lanes, two
+ * pixels per 128-bit vector, and divide by the box width with the high half
+ * of a 16-bit multiply. GCC vector extensions carry the arithmetic; the few
+ * operations they do not express well use SSE2 directly and fall back to
+ * generic code elsewhere. The scalar kernels compute the exact same integer
+ * math and serve as the reference.
+ */
+
+typedef uint32_t v4u __attribute__((vector_size(16)));
+typedef uint8_t v4b __attribute__((vector_size(4)));
+typedef uint16_t v8h __attribute__((vector_size(16)));
+typedef uint8_t v8b __attribute__((vector_size(8)));
+typedef uint8_t v16b __attribute__((vector_size(16)));
+typedef uint32_t v8w __attribute__((vector_size(32)));
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* Fixed point reciprocal of the box width */
+static uint32_t blur_inv(int radius) {
+	uint32_t d = 2 * radius + 1;
+	return (65536 + d / 2) / d;
+}
+
+static inline v4u load4(const uint32_t *p) {
+	v4b b;
+	memcpy(&b, p, sizeof(b));
+	return __builtin_convertvector(b, v4u);
+}
+
+static inline void store4(uint32_t *p, v4u v) {
+	v4b b = __builtin_convertvector(v, v4b);
+	memcpy(p, &b, sizeof(b));
+}
+
+static inline v16b load16(const uint32_t *p) {
+	v16b b;
+	memcpy(&b, p, sizeof(b));
+	return b;
+}
+
+/* Zero-extend the low and high eight bytes to 16-bit lanes */
+static inline v8h widen_lo(v16b b) {
+#ifdef __SSE2__
+	return (v8h)_mm_unpacklo_epi8((__m128i)b, _mm_setzero_si128());
+#else
+	v8b h;
+	memcpy(&h, &b, sizeof(h));
+	return __builtin_convertvector(h, v8h);
+#endif
+}
+
+static inline v8h widen_hi(v16b b) {
+#ifdef __SSE2__
+	return (v8h)_mm_unpackhi_epi8((__m128i)b, _mm_setzero_si128());
+#else
+	v8b h;
+	memcpy(&h, (const uint8_t *)&b + sizeof(h), sizeof(h));
+	return __builtin_convertvector(h, v8h);
+#endif
+}
+
+/* (a * b) >> 16 per lane */
+static inline v8h mulhi(v8h a, v8h b) {
+#ifdef __SSE2__
+	return (v8h)_mm_mulhi_epu16((__m128i)a, (__m128i)b);
+#else
+	return __builtin_convertvector((__builtin_convertvector(a, v8w) * __builtin_convertvector(b, v8w)) >> 16, v8h);
+#endif
+}
+
+/* Narrow two vectors of lanes known to be at most 255 back to bytes */
+static inline v16b pack(v8h lo, v8h hi) {
+#ifdef __SSE2__
+	return (v16b)_mm_packus_epi16((__m128i)lo, (__m128i)hi);
+#else
+	v8b l = __builtin_convertvector(lo, v8b), h = __builtin_convertvector(hi, v8b);
+	v16b b;
+	memcpy(&b, &l, sizeof(l));
+	memcpy((uint8_t *)&b + sizeof(l), &h, sizeof(h));
+	return b;
+#endif
+}
+
+/* One pixel, repeated in both halves of a vector */
+static inline v8h load1(const uint32_t *p) {
+	uint32_t px[4] = { *p, *p, 0, 0 };
+	v16b v;
+	memcpy(&v, px, sizeof(v));
+	return widen_lo(v);
+}
+
+/* Move the low pixel up and clear the low half; repeat the high pixel */
+static inline v8h shift_pixel(v8h v) {
+	return __builtin_shufflevector(v, (v8h){0}, 8, 9, 10, 11, 0, 1, 2, 3);
+}
+
+static inline v8h high_pixel(v8h v) {
+	return __builtin_shufflevector(v, v, 4, 5, 6, 7, 4, 5, 6, 7);
+}
+
+/* Horizontal pass over rows [start, end). Away from the edges four pixels
+ * are done at once: the window differences for all four are a prefix sum on
+ * top of the running total, so only one add per four pixels is serial. The
+ * total is kept in both halves of sum. */
+static void blur_rows_simd(blur_job_t *job) {
+	int w = job->width, r = job->radius;
+	v8h inv = (v8h){0} + (uint16_t)blur_inv(r);
+
+	for (int y = job->start; y < job->end; y++) {
+		const uint32_t *src = job->src + (size_t)y * job->stride;
+		uint32_t *dst = job->dst + (size_t)y * job->stride;
+
+		v8h sum = load1(&src[0]) * (uint16_t)(r + 1);
+		for (int i = 1; i <= r; i++) sum += load1(&src[MIN(i, w - 1)]);
+		for (int x = 0; x < w; ) {
+			if (x < r || x + r + 4 >= w) {
+				v16b out = pack(mulhi(sum, inv), sum);
+				memcpy(&dst[x], &out, sizeof(uint32_t));
+				sum += load1(&src[MIN(x + r + 1, w - 1)]) - load1(&src[MAX(x - r, 0)]);
+				x++;
+				continue;
+			}
+			v16b in = load16(&src[x + r + 1]), old = load16(&src[x - r]);
+			v8h d_lo = widen_lo(in) - widen_lo(old), d_hi = widen_hi(in) - widen_hi(old);
+			v8h e_lo = shift_pixel(d_lo);
+			v8h e_hi = high_pixel(d_lo + e_lo) + shift_pixel(d_hi);
+			v16b out = pack(mulhi(sum + e_lo, inv), mulhi(sum + e_hi, inv));
+			memcpy(&dst[x], &out, sizeof(out));
+			sum += high_pixel(e_hi + d_hi);
+			x += 4;
+		}
+	}
+}
+
+static void blur_cols_scalar(blur_job_t *job);
+
+/* Vertical pass over columns [start, end), streaming rows through per-column
+ * running sums, four pixels per step */
+static void blur_cols_simd(blur_job_t *job) {
+	int h = job->height, r = job->radius, stride = job->stride;
+	int x0 = job->start, n = job->end - job->start;
+	int vec = n & ~3;
+	v8h inv = (v8h){0} + (uint16_t)blur_inv(r);
+	v8h *acc = (v8h *)job->acc;
+
+	#define ROW(y) (job->src + (size_t)(y) * stride + x0)
+
+	/* Prime the sums with the clamped top edge */
+	for (int x = 0; x < vec; x += 4) {
+		v16b b = load16(ROW(0) + x);
+		acc[x / 2] = widen_lo(b) * (uint16_t)(r + 1);
+		acc[x / 2 + 1] = widen_hi(b) * (uint16_t)(r + 1);
+	}
+	for (int i = 1; i <= r; i++) {
+		const uint32_t *src = ROW(MIN(i, h - 1));
+		for (int x = 0; x < vec; x += 4) {
+			v16b b = load16(src + x);
+			acc[x / 2] += widen_lo(b);
+			acc[x / 2 + 1] += widen_hi(b);
+		}
+	}
+
+	for (int y = 0; y < h; y++) {
+		const uint32_t *add = ROW(MIN(y + r + 1, h - 1));
+		const uint32_t *sub = ROW(MAX(y - r, 0));
+		uint32_t *dst = job->dst + (size_t)y * stride + x0;
+
+		for (int x = 0; x < vec; x += 4) {
+			v8h lo = acc[x / 2], hi = acc[x / 2 + 1];
+			v16b out = pack(mulhi(lo, inv), mulhi(hi, inv));
+			memcpy(&dst[x], &out, sizeof(out));
+			v16b in = load16(add + x), old = load16(sub + x);
+			acc[x / 2] = lo + widen_lo(in) - widen_lo(old);
+			acc[x / 2 + 1] = hi + widen_hi(in) - widen_hi(old);
+		}
+	}
+
+	#undef ROW
+
+	/* Fewer than four columns left over */
+	if (vec < n) {
+		blur_job_t tail = *job;
+		tail.start = x0 + vec;
+		tail.acc = job->acc + (size_t)vec * 4;
+		blur_cols_scalar(&tail);
+	}
+}
+
+/* Scalar reference for the horizontal pass */
+static void blur_rows_scalar(blur_job_t *job) {
+	int w = job->width, r = job->radius;
+	uint32_t inv = blur_inv(r);
+
+	for (int y = job->start; y < job->end; y++) {
+		const uint8_t *src = (const uint8_t *)(job->src + (size_t)y * job->stride);
+		uint8_t *dst = (uint8_t *)(job->dst + (size_t)y * job->stride);
+
+		for (int c = 0; c < 4; c++) {
+			uint32_t sum = src[c] * (uint32_t)(r + 1);
+			for (int i = 1; i <= r; i++) sum += src[MIN(i, w - 1) * 4 + c];
+			for (int x = 0; x < w; x++) {
+				dst[x * 4 + c] = (sum * inv) >> 16;
+				sum += src[MIN(x + r + 1, w - 1) * 4 + c] - src[MAX(x - r, 0) * 4 + c];
+			}
+		}
+	}
+}
+
+/* Scalar reference for the vertical pass, streaming rows through one running sum per channel */
+static void blur_cols_scalar(blur_job_t *job) {
+	int h = job->height, r = job->radius, stride = job->stride;
+	int x0 = job->start, n = (job->end - job->start) * 4;
+	uint32_t inv = blur_inv(r);
+	uint32_t *acc = job->acc;
+
+	#define ROW(y) ((const uint8_t *)(job->src + (size_t)(y) * stride + x0))
+
+	for (int i = 0; i < n; i++) acc[i] = ROW(0)[i] * (uint32_t)(r + 1);
+	for (int k = 1; k <= r; k++) {
+		const uint8_t *src = ROW(MIN(k, h - 1));
+		for (int i = 0; i < n; i++) acc[i] += src[i];
+	}
+
+	for (int y = 0; y < h; y++) {
+		const uint8_t *add = ROW(MIN(y + r + 1, h - 1));
+		const uint8_t *sub = ROW(MAX(y - r, 0));
+		uint8_t *dst = (uint8_t *)(job->dst + (size_t)y * stride + x0);
+
+		for (int i = 0; i < n; i++) {
+			dst[i] = (acc[i] * inv) >> 16;
+			acc[i] += add[i] - sub[i];
+		}
+	}
+
+	#undef ROW
+}
+
+/* Average factor x factor blocks of src into dst rows [start, end). Up to
+ * 16 x 16 blocks the sums fit 16-bit lanes and four pixels are added at once */
+static void blur_downscale_rows(blur_job_t *job) {
+	int f = job->factor;
+	int dw = job->width / f;
+	uint32_t scale = 65536 / (f * f);
+	v8h inv = (v8h){0} + (uint16_t)scale;
+
+	for (int y = job->start; y < job->end; y++) {
+		uint32_t *dst = job->dst + (size_t)y * dw;
+		for (int x = 0; x < dw; x++) {
+			if (f < 2 || f > 16) {
+				v4u sum = {0, 0, 0, 0};
+				for (int j = 0; j < f; j++) {
+					const uint32_t *src = job->src + (size_t)(y * f + j) * job->stride + x * f;
+					for (int i = 0; i < f; i++) sum += load4(&src[i]);
+				}
+				store4(&dst[x], (sum * scale) >> 16);
+				continue;
+			}
+
+			/* Two pixels' worth of channel sums per vector, folded at the end */
+			v8h lo = {0}, hi = {0};
+			for (int j = 0; j < f; j++) {
+				const uint32_t *src = job->src + (size_t)(y * f + j) * job->stride + x * f;
+				int i = 0;
+				for (; i + 4 <= f; i += 4) {
+					v16b b = load16(&src[i]);
+					lo += widen_lo(b);
+					hi += widen_hi(b);
+				}
+				for (; i < f; i++) lo += load1(&src[i]) & (v8h){0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF};
+			}
+			lo += hi;
+			lo += __builtin_shufflevector(lo, lo, 4, 5, 6, 7, 0, 1, 2, 3);
+			v16b out = pack(mulhi(lo, inv), lo);
+			memcpy(&dst[x], &out, sizeof(uint32_t));
+		}
+	}
+}
+
+static void blur_rows(blur_job_t *job) {
+	if (job->simd) blur_rows_simd(job);
+	else blur_rows_scalar(job);
+}
+
+static void blur_cols(blur_job_t *job) {
+	if (job->simd) blur_cols_simd(job);
+	else blur_cols_scalar(job);
+}
+
+/* Worker threads are started once and wait for bands of the next pass. Only
+ * one thread at a time may run a blur. */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+	pthread_t tids[BLUR_MAX_THREADS];
+	unsigned long joined[BLUR_MAX_THREADS];  /* Round current when each worker started */
+	int workers;
+	unsigned long round;  /* Bumped for every dispatched pass */
+	int pending;          /* Workers still on the current pass */
+	int active;           /* Workers given a band this pass; the rest sit it out */
+	int quit;
+	blur_job_t *jobs;     /* One band per worker */
+	void (*fn)(blur_job_t *job);
+} pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+static void *blur_worker(void *arg) {
+	int id = (int)(intptr_t)arg;
+
+	pthread_mutex_lock(&pool.lock);
+	unsigned long seen = pool.joined[id];
+	for (;;) {
+		while (!pool.quit && pool.round == seen) pthread_cond_wait(&pool.work, &pool.lock);
+		if (pool.quit) break;
+		seen = pool.round;
+		blur_job_t *job = id < pool.active ? &pool.jobs[id] : NULL;
+		void (*fn)(blur_job_t *) = pool.fn;
+		pthread_mutex_unlock(&pool.lock);
+
+		if (job && job->start < job->end) fn(job);
+
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.pending == 0) pthread_cond_signal(&pool.done);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+/* Start workers so a blur on this many threads needs no thread creation */
+void blur_start(int threads) {
+	threads = MAX(1, MIN(threads, BLUR_MAX_THREADS));
+	while (pool.workers < threads - 1) {
+		pool.joined[pool.workers] = pool.round;
+		if (pthread_create(&pool.tids[pool.workers], NULL, blur_worker, (void *)(intptr_t)pool.workers) != 0) break;
+		pool.workers++;
+	}
+}
+
+/* Stop the workers; a later blur starts them again */
+void blur_free() {
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = 1;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+	for (int i = 0; i < pool.workers; i++) pthread_join(pool.tids[i], NULL);
+	pool.workers = 0;
+	pool.quit = 0;
+}
+
+/* Split one pass into bands: one per worker, the rest on the calling thread */
+static void blur_pass(blur_job_t *base, int count, int threads, void (*fn)(blur_job_t *job)) {
+	blur_job_t jobs[BLUR_MAX_THREADS];
+	int band = (count + threads - 1) / threads;
+
+	/* Keep vertical bands a multiple of four pixels for the SIMD path */
+	band = (band + 3) & ~3;
+
+	for (int i = 0; i < threads; i++) {
+		jobs[i] = *base;
+		jobs[i].start = MIN(i * band, count);
+		jobs[i].end = MIN(jobs[i].start + band, count);
+		jobs[i].acc = base->acc ? base->acc + (size_t)jobs[i].start * 4 : NULL;
+	}
+
+	blur_start(threads);
+	int helpers = MIN(pool.workers, threads - 1);
+	if (pool.workers) {
+		pthread_mutex_lock(&pool.lock);
+		pool.jobs = jobs;
+		pool.fn = fn;
+		pool.pending = pool.workers;
+		pool.active = helpers;
+		pool.round++;
+		pthread_cond_broadcast(&pool.work);
+		pthread_mutex_unlock(&pool.lock);
+	}
+
+	for (int i = helpers; i < threads; i++) {
+		if (jobs[i].start < jobs[i].end) fn(&jobs[i]);
+	}
+
+	if (pool.workers) {
+		pthread_mutex_lock(&pool.lock);
+		while (pool.pending) pthread_cond_wait(&pool.done, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+	}
+}
+
+/* Blur pixels in place; scratch must be as large as pixels. Returns 0 if out of memory */
+static int blur_run(uint32_t *pixels, uint32_t *scratch, int width, int height, int stride, int radius, int passes, int threads, int simd) {
+	if (radius <= 0 || width <= 0 || height <= 0) return 1;
+	radius = MIN(radius, BLUR_MAX_RADIUS);
+	threads = MAX(1, MIN(threads, BLUR_MAX_THREADS));
+
+	/* Per-column running sums for the vertical pass */
+	uint32_t *acc = malloc((size_t)width * 4 * sizeof(uint32_t));
+	if (!acc) return 0;
+
+	for (int p = 0; p < passes; p++) {
+		blur_job_t rows = { pixels, scratch, NULL, width, height, stride, radius, 0, 0, simd, 1 };
+		blur_pass(&rows, height, threads, blur_rows);
+
+		blur_job_t cols = { scratch, pixels, acc, width, height, stride, radius, 0, 0, simd, 1 };
+		blur_pass(&cols, width, threads, blur_cols);
+	}
+
+	free(acc);
+	return 1;
+}
+
+/* Number of worker threads to use for a blur */
+int blur_threads() {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)MIN(n, BLUR_MAX_THREADS) : 1;
+}
+
+/* Shrink src by an integer factor into dst, which is (width / factor) pixels wide */
+void blur_downscale(const uint32_t *src, int width, int height, int stride, uint32_t *dst, int factor, int threads) {
+	if (factor <= 0 || width < factor || height < factor) return;
+	threads = MAX(1, MIN(threads, BLUR_MAX_THREADS));
+
+	blur_job_t job = { src, dst, NULL, width, height, stride, 0, 0, 0, 1, factor };
+	blur_pass(&job, height / factor, threads, blur_downscale_rows);
+}
+
+/* Multi-threaded SIMD blur */
+int blur_image(uint32_t *pixels, uint32_t *scratch, int width, int height, int stride, int radius, int passes, int threads) {
+	return blur_run(pixels, scratch, width, height, stride, radius, passes, threads, 1);
+}
+
+/* Single-threaded scalar reference blur */
+int blur_image_scalar(uint32_t *pixels, uint32_t *scratch, int width, int height, int stride, int radius, int passes) {
+	return blur_run(pixels, scratch, width, height, stride, radius, passes, 1, 0);
+}
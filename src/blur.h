@@ -0,0 +1,31 @@
+#ifndef BLUR_H
+#define BLUR_H
+
+#include <stdint.h>
+
+#define BLUR_MAX_RADIUS 127
+#define BLUR_MAX_THREADS 32
+
+/* Slice of a blur pass handed to one worker thread */
+typedef struct _blur_job {
+	const uint32_t *src;
+	uint32_t *dst;
+	uint32_t *acc;
+	int width;
+	int height;
+	int stride;
+	int radius;
+	int start;
+	int end;
+	int simd;
+	int factor;
+} blur_job_t;
+
+int blur_threads();
+void blur_start(int threads);
+void blur_free();
+void blur_downscale(const uint32_t *src, int width, int height, int stride, uint32_t *dst, int factor, int threads);
+int blur_image(uint32_t *pixels, uint32_t *scratch, int width, int height, int stride, int radius, int passes, int threads);
+int blur_image_scalar(uint32_t *pixels, uint32_t *scratch, int width, int height, int stride, int radius, int passes);
+
+#endif /* BLUR_H */
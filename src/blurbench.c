@@ -0,0 +1,86 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blur.h"
+#include "util.h"
+
+/* Lock screen blur benchmark: SIMD + threads against the scalar reference at 4K */
+
+#define BENCH_W 3840
+#define BENCH_H 2160
+#define BENCH_RADIUS 12
+#define BENCH_PASSES 3
+#define BENCH_RUNS 5
+#define BENCH_SCALE 4
+
+static long bench(uint32_t *pixels, uint32_t *scratch, const uint32_t *orig, int threads, int simd) {
+	long best = -1;
+	for (int i = 0; i < BENCH_RUNS; i++) {
+		struct timespec start;
+		memcpy(pixels, orig, (size_t)BENCH_W * BENCH_H * 4);
+		timer_start(&start);
+		if (simd) {
+			blur_image(pixels, scratch, BENCH_W, BENCH_H, BENCH_W, BENCH_RADIUS, BENCH_PASSES, threads);
+		} else {
+			blur_image_scalar(pixels, scratch, BENCH_W, BENCH_H, BENCH_W, BENCH_RADIUS, BENCH_PASSES);
+		}
+		long us = timer_elapsed_us(&start);
+		if (best < 0 || us < best) best = us;
+	}
+	return best;
+}
+
+/* Downscale then blur, as the lock screen does before XRender upscales it */
+static long bench_scaled(uint32_t *small, uint32_t *scratch, const uint32_t *orig, int threads) {
+	int sw = BENCH_W / BENCH_SCALE, sh = BENCH_H / BENCH_SCALE;
+	long best = -1;
+	for (int i = 0; i < BENCH_RUNS; i++) {
+		struct timespec start;
+		timer_start(&start);
+		blur_downscale(orig, BENCH_W, BENCH_H, BENCH_W, small, BENCH_SCALE, threads);
+		blur_image(small, scratch, sw, sh, sw, BENCH_RADIUS / BENCH_SCALE, BENCH_PASSES, threads);
+		long us = timer_elapsed_us(&start);
+		if (best < 0 || us < best) best = us;
+	}
+	return best;
+}
+
+int main() {
+	size_t count = (size_t)BENCH_W * BENCH_H;
+	uint32_t *orig = malloc(count * 4);
+	uint32_t *pixels = malloc(count * 4);
+	uint32_t *reference = malloc(count * 4);
+	uint32_t *scratch = malloc(count * 4);
+	if (!orig || !pixels || !reference || !scratch) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	srand(1);
+	for (size_t i = 0; i < count; i++) {
+		orig[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+	}
+
+	int threads = blur_threads();
+	long scalar = bench(reference, scratch, orig, 1, 0);
+	long simd1 = bench(pixels, scratch, orig, 1, 1);
+	int same = !memcmp(pixels, reference, count * 4);
+	long simdn = bench(pixels, scratch, orig, threads, 1);
+	same = same && !memcmp(pixels, reference, count * 4);
+	long scaled = bench_scaled(pixels, scratch, orig, threads);
+
+	printf("%dx%d radius %d, %d passes (best of %d)\n", BENCH_W, BENCH_H, BENCH_RADIUS, BENCH_PASSES, BENCH_RUNS);
+	printf("  scalar, 1 thread:   %8.2f ms\n", scalar / 1000.0);
+	printf("  simd,   1 thread:   %8.2f ms (%.1fx)\n", simd1 / 1000.0, (double)scalar / simd1);
+	printf("  simd, %2d threads:   %8.2f ms (%.1fx)\n", threads, simdn / 1000.0, (double)scalar / simdn);
+	printf("  1/%d scale, %2d threads: %5.2f ms (downscale + blur)\n", BENCH_SCALE, threads, scaled / 1000.0);
+	printf("  output %s the scalar reference\n", same ? "matches" : "DIFFERS FROM");
+
+	blur_free();
+	free(orig);
+	free(pixels);
+	free(reference);
+	free(scratch);
+	return same ? 0 : 1;
+}
@@ -0,0 +1,437 @@
+#include "compositor.h"
+
+#ifdef COMPOSITOR
+#include <stdio.h>
+#include <stdlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/Xcomposite.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#include <X11/extensions/Xrender.h>
+#include <X11/extensions/shape.h>
+#include "evloop.h"
+#include "monitor.h"
+#include "trace.h"
+#include "util.h"
+
+/* One redirected child of the root window; the list runs bottom to top */
+typedef struct _cwin {
+	Window id;
+	int x, y, width, height, border;
+	int mapped;
+	int argb;
+	XRenderPictFormat *format;
+	Damage damage;
+	Pixmap pixmap;
+	Picture picture;
+	int stale; /* picture predates the last map */
+	struct timespec mapped_at;
+	struct _cwin *next, *prev;
+} cwin_t;
+
+static Display *dpy;
+static Window root, overlay;
+static int scr;
+static int screen_width, screen_height;
+static int damage_event_base = -1;
+static int active = 0;
+static cwin_t *stack = NULL;
+static Damage root_damage;
+static Pixmap back_pixmap;
+static Picture root_picture, back_picture, overlay_picture, shadow_picture;
+static XserverRegion dirty;
+static int paint_timer = 0;
+static compositor_damage_fn damage_fn;
+#ifdef TIMING
+static long frame_count, frame_total_ns, frame_max_ns;
+#endif
+
+static void paint_frame(void *arg);
+
+static cwin_t *find(Window id) {
+	for (cwin_t *cw = stack; cw; cw = cw->next) {
+		if (cw->id == id) return cw;
+	}
+	return NULL;
+}
+
+static void unlink_window(cwin_t *cw) {
+	if (cw->prev) cw->prev->next = cw->next;
+	else stack = cw->next;
+	if (cw->next) cw->next->prev = cw->prev;
+	cw->next = cw->prev = NULL;
+}
+
+/* Insert directly above below, or at the bottom when below is NULL */
+static void link_above(cwin_t *cw, cwin_t *below) {
+	cw->prev = below;
+	cw->next = below ? below->next : stack;
+	if (cw->next) cw->next->prev = cw;
+	if (below) below->next = cw;
+	else stack = cw;
+}
+
+static cwin_t *top() {
+	cwin_t *cw = stack;
+	while (cw && cw->next) cw = cw->next;
+	return cw;
+}
+
+/* Paint at the next frame boundary; everything damaged until then shares the paint */
+static void schedule() {
+	if (paint_timer) return;
+	paint_timer = evloop_add_timer(1000000L / monitor_refresh_rate(), paint_frame, NULL);
+	if (!paint_timer) paint_frame(NULL);
+}
+
+static void add_damage(int x, int y, int width, int height) {
+	XRectangle rect = { x, y, width, height };
+	XserverRegion region = XFixesCreateRegion(dpy, &rect, 1);
+	XFixesUnionRegion(dpy, dirty, dirty, region);
+	XFixesDestroyRegion(dpy, region);
+	schedule();
+}
+
+/* Screen area a window covers, border and shadow included */
+static void damage_extents(cwin_t *cw) {
+	add_damage(cw->x, cw->y, cw->width + 2 * cw->border + SHADOW_OFFSET,
+		cw->height + 2 * cw->border + SHADOW_OFFSET);
+}
+
+static void release_picture(cwin_t *cw) {
+	if (cw->picture) XRenderFreePicture(dpy, cw->picture);
+	if (cw->pixmap) XFreePixmap(dpy, cw->pixmap);
+	cw->picture = None;
+	cw->pixmap = None;
+}
+
+/* Take a reference on the window's current off-screen pixmap */
+static void name_picture(cwin_t *cw) {
+	XRenderPictureAttributes pa;
+
+	pa.subwindow_mode = IncludeInferiors;
+	cw->pixmap = XCompositeNameWindowPixmap(dpy, cw->id);
+	cw->picture = XRenderCreatePicture(dpy, cw->pixmap, cw->format, CPSubwindowMode, &pa);
+	cw->stale = 0;
+}
+
+static void add_window(Window id) {
+	XWindowAttributes wa;
+
+	if (id == overlay || find(id) || !TRACE_X("XGetWindowAttributes", XGetWindowAttributes(dpy, id, &wa)) ||
+			wa.class == InputOnly) return;
+	cwin_t *cw = calloc(1, sizeof(cwin_t));
+	if (!cw) return;
+	cw->id = id;
+	cw->x = wa.x;
+	cw->y = wa.y;
+	cw->width = wa.width;
+	cw->height = wa.height;
+	cw->border = wa.border_width;
+	cw->mapped = wa.map_state == IsViewable;
+	cw->format = XRenderFindVisualFormat(dpy, wa.visual);
+	cw->argb = cw->format && cw->format->type == PictTypeDirect && cw->format->direct.alphaMask;
+	cw->damage = XDamageCreate(dpy, id, XDamageReportNonEmpty);
+	link_above(cw, top());
+	if (cw->mapped) damage_extents(cw);
+}
+
+/* destroyed: the server already freed the window and its damage object */
+static void remove_window(cwin_t *cw, int destroyed) {
+	if (cw->mapped) damage_extents(cw);
+	if (!destroyed) XDamageDestroy(dpy, cw->damage);
+	release_picture(cw);
+	unlink_window(cw);
+	free(cw);
+}
+
+static void create_back_buffer() {
+	XRenderPictFormat *format = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, scr));
+
+	back_pixmap = XCreatePixmap(dpy, root, screen_width, screen_height, DefaultDepth(dpy, scr));
+	back_picture = XRenderCreatePicture(dpy, back_pixmap, format, 0, NULL);
+}
+
+static void free_back_buffer() {
+	XRenderFreePicture(dpy, back_picture);
+	XFreePixmap(dpy, back_pixmap);
+}
+
+/* Redirect every top-level window off-screen and paint them onto the overlay */
+int compositor_init(Display *display, int screen, compositor_damage_fn damage) {
+	int event_base, error_base, major = 0, minor = 4;
+	Window root_return, parent_return, *children = NULL;
+	unsigned int n = 0;
+
+	dpy = display;
+	scr = screen;
+	root = RootWindow(dpy, scr);
+	damage_fn = damage;
+
+	/* The overlay window needs Composite 0.3 */
+	if (!XCompositeQueryExtension(dpy, &event_base, &error_base) ||
+			!XCompositeQueryVersion(dpy, &major, &minor) || (major == 0 && minor < 3)) {
+		return 0;
+	}
+	if (!XDamageQueryExtension(dpy, &damage_event_base, &error_base) ||
+			!XDamageQueryVersion(dpy, &major, &minor)) {
+		return 0;
+	}
+	if (!XFixesQueryExtension(dpy, &event_base, &error_base) ||
+			!XFixesQueryVersion(dpy, &major, &minor)) {
+		return 0;
+	}
+
+	monitor_screen_size(&screen_width, &screen_height);
+	XCompositeRedirectSubwindows(dpy, root, CompositeRedirectManual);
+
+	/* Clicks go through the overlay to the windows underneath */
+	overlay = XCompositeGetOverlayWindow(dpy, root);
+	XserverRegion empty = XFixesCreateRegion(dpy, NULL, 0);
+	XFixesSetWindowShapeRegion(dpy, overlay, ShapeInput, 0, 0, empty);
+	XFixesDestroyRegion(dpy, empty);
+
+	XRenderPictFormat *format = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, scr));
+	XRenderColor shadow = { 0, 0, 0, SHADOW_OPACITY };
+	root_picture = XRenderCreatePicture(dpy, root, format, 0, NULL);
+	overlay_picture = XRenderCreatePicture(dpy, overlay, format, 0, NULL);
+	shadow_picture = XRenderCreateSolidFill(dpy, &shadow);
+	create_back_buffer();
+	dirty = XFixesCreateRegion(dpy, NULL, 0);
+	root_damage = XDamageCreate(dpy, root, XDamageReportNonEmpty);
+	active = 1;
+
+	/* Adopt existing windows; XQueryTree lists them bottom to top */
+	if (XQueryTree(dpy, root, &root_return, &parent_return, &children, &n)) {
+		for (unsigned int i = 0; i < n; i++) add_window(children[i]);
+		if (children) XFree(children);
+	}
+	add_damage(0, 0, screen_width, screen_height);
+	return 1;
+}
+
+int compositor_active() {
+	return active;
+}
+
+/* Last named pixmap of a window, kept while it is unmapped; None before its first paint */
+Pixmap compositor_window_pixmap(Window id) {
+	cwin_t *cw = active ? find(id) : NULL;
+	return cw ? cw->pixmap : None;
+}
+
+/* Compose the damaged region into the back buffer and copy it to the overlay */
+static void paint_frame(void *arg) {
+	int grace = 0;
+	TRACE_BEGIN("paint_frame");
+#ifdef TIMING
+	struct timespec start;
+	timer_start(&start);
+#endif
+
+	paint_timer = 0;
+	XFixesSetPictureClipRegion(dpy, back_picture, 0, 0, dirty);
+	XRenderComposite(dpy, PictOpSrc, root_picture, None, back_picture,
+		0, 0, 0, 0, 0, 0, screen_width, screen_height);
+
+	for (cwin_t *cw = stack; cw; cw = cw->next) {
+		if (!cw->mapped) continue;
+
+		/* A restored window shows its kept pixmap until the client has had time to redraw */
+		if (cw->stale && cw->picture && timer_elapsed_us(&cw->mapped_at) < MAP_GRACE_US) {
+			grace = 1;
+		} else if (cw->stale || !cw->picture) {
+			release_picture(cw);
+			name_picture(cw);
+		}
+
+		int width = cw->width + 2 * cw->border;
+		int height = cw->height + 2 * cw->border;
+		if (!cw->argb) {
+			XRenderComposite(dpy, PictOpOver, shadow_picture, None, back_picture,
+				0, 0, 0, 0, cw->x + SHADOW_OFFSET, cw->y + SHADOW_OFFSET, width, height);
+		}
+		XRenderComposite(dpy, cw->argb ? PictOpOver : PictOpSrc, cw->picture, None, back_picture,
+			0, 0, 0, 0, cw->x, cw->y, width, height);
+	}
+
+	XFixesSetPictureClipRegion(dpy, overlay_picture, 0, 0, dirty);
+	XRenderComposite(dpy, PictOpSrc, back_picture, None, overlay_picture,
+		0, 0, 0, 0, 0, 0, screen_width, screen_height);
+	XFixesSetRegion(dpy, dirty, NULL, 0);
+
+	/* Come back for windows still showing a kept pixmap */
+	for (cwin_t *cw = stack; grace && cw; cw = cw->next) {
+		if (cw->mapped && cw->stale) damage_extents(cw);
+	}
+
+#ifdef TIMING
+	/* Include the server's share of the work */
+	XSync(dpy, False);
+	long ns = timer_elapsed_ns(&start);
+	frame_count++;
+	frame_total_ns += ns;
+	if (ns > frame_max_ns) frame_max_ns = ns;
+	if (frame_count % COMPOSITOR_REPORT_FRAMES == 0) {
+		fprintf(stderr, "compositor: %ld frames, avg %.2f us, max %.2f us\n",
+			frame_count, frame_total_ns / 1000.0 / frame_count, frame_max_ns / 1000.0);
+	}
+#else
+	XFlush(dpy);
+#endif
+	TRACE_END("paint_frame");
+}
+
+static void damage_notify(XDamageNotifyEvent *ev) {
+	XserverRegion parts = XFixesCreateRegion(dpy, NULL, 0);
+	cwin_t *cw = find(ev->drawable);
+
+	/* Damage is reported relative to the window's origin, inside its border */
+	XDamageSubtract(dpy, ev->damage, None, parts);
+	if (cw) XFixesTranslateRegion(dpy, parts, cw->x + cw->border, cw->y + cw->border);
+	XFixesUnionRegion(dpy, dirty, dirty, parts);
+	XFixesDestroyRegion(dpy, parts);
+	schedule();
+	if (cw && damage_fn) damage_fn(cw->id);
+}
+
+static void configure_notify(XConfigureEvent *ev) {
+	cwin_t *cw;
+
+	if (ev->window == root) {
+		free_back_buffer();
+		screen_width = ev->width;
+		screen_height = ev->height;
+		create_back_buffer();
+		add_damage(0, 0, screen_width, screen_height);
+		return;
+	}
+	if (!(cw = find(ev->window))) return;
+
+	if (cw->mapped) damage_extents(cw);
+	/* A new size means a new backing pixmap */
+	if (cw->width != ev->width || cw->height != ev->height || cw->border != ev->border_width) {
+		release_picture(cw);
+	}
+	cw->x = ev->x;
+	cw->y = ev->y;
+	cw->width = ev->width;
+	cw->height = ev->height;
+	cw->border = ev->border_width;
+
+	/* Siblings we do not track (input-only windows) leave the order as it was */
+	cwin_t *below = ev->above == None ? NULL : find(ev->above);
+	if (ev->above == None || below) {
+		unlink_window(cw);
+		link_above(cw, below);
+	}
+	if (cw->mapped) damage_extents(cw);
+}
+
+/* Structure events are only observed; the window manager handles them too */
+int compositor_handle_event(XEvent *ev) {
+	cwin_t *cw;
+
+	if (!active) return 0;
+	if (ev->type == damage_event_base + XDamageNotify) {
+		damage_notify((XDamageNotifyEvent *)ev);
+		return 1;
+	}
+
+	switch (ev->type) {
+		case CreateNotify:
+			if (ev->xcreatewindow.parent == root) add_window(ev->xcreatewindow.window);
+			break;
+		case DestroyNotify:
+			if (ev->xdestroywindow.event == root && (cw = find(ev->xdestroywindow.window))) {
+				remove_window(cw, 1);
+			}
+			break;
+		case MapNotify:
+			if (ev->xmap.event == root && (cw = find(ev->xmap.window))) {
+				cw->mapped = 1;
+				cw->stale = 1;
+				timer_start(&cw->mapped_at);
+				damage_extents(cw);
+			}
+			break;
+		case UnmapNotify:
+			/* Keep the pixmap so the window can be shown again without waiting on its client */
+			if (ev->xunmap.event == root && (cw = find(ev->xunmap.window))) {
+				damage_extents(cw);
+				cw->mapped = 0;
+			}
+			break;
+		case ConfigureNotify:
+			if (ev->xconfigure.event == root) configure_notify(&ev->xconfigure);
+			break;
+		case ReparentNotify:
+			if (ev->xreparent.parent == root) {
+				add_window(ev->xreparent.window);
+			} else if (ev->xreparent.event == root && (cw = find(ev->xreparent.window))) {
+				remove_window(cw, 0);
+			}
+			break;
+		case CirculateNotify:
+			if (ev->xcirculate.event == root && (cw = find(ev->xcirculate.window))) {
+				unlink_window(cw);
+				link_above(cw, ev->xcirculate.place == PlaceOnTop ? top() : NULL);
+				if (cw->mapped) damage_extents(cw);
+			}
+			break;
+	}
+	return 0;
+}
+
+void compositor_free() {
+	if (!active) return;
+	if (paint_timer) evloop_cancel_timer(paint_timer);
+	while (stack) {
+		cwin_t *cw = stack;
+		XDamageDestroy(dpy, cw->damage);
+		release_picture(cw);
+		unlink_window(cw);
+		free(cw);
+	}
+
+#ifdef TIMING
+	if (frame_count) {
+		fprintf(stderr, "compositor: %ld frames, avg %.2f us, max %.2f us\n",
+			frame_count, frame_total_ns / 1000.0 / frame_count, frame_max_ns / 1000.0);
+	}
+#endif
+
+	XDamageDestroy(dpy, root_damage);
+	XFixesDestroyRegion(dpy, dirty);
+	free_back_buffer();
+	XRenderFreePicture(dpy, root_picture);
+	XRenderFreePicture(dpy, overlay_picture);
+	XRenderFreePicture(dpy, shadow_picture);
+	XCompositeReleaseOverlayWindow(dpy, root);
+	XCompositeUnredirectSubwindows(dpy, root, CompositeRedirectManual);
+	active = 0;
+}
+
+#else
+
+/* Built without Composite, Damage and XFixes: windows draw straight to the screen */
+int compositor_init(Display *display, int screen, compositor_damage_fn damage) {
+	return 0;
+}
+
+int compositor_active() {
+	return 0;
+}
+
+Pixmap compositor_window_pixmap(Window id) {
+	return None;
+}
+
+int compositor_handle_event(XEvent *ev) {
+	return 0;
+}
+
+void compositor_free() {
+}
+
+#endif /* COMPOSITOR */
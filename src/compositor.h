@@ -0,0 +1,20 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <X11/Xlib.h>
+
+#define SHADOW_OFFSET 4
+#define SHADOW_OPACITY 0x4000
+#define MAP_GRACE_US 50000
+#define COMPOSITOR_REPORT_FRAMES 300
+
+/* Told about content changes to a redirected top-level window */
+typedef void (*compositor_damage_fn)(Window id);
+
+int compositor_init(Display *display, int screen, compositor_damage_fn damage);
+int compositor_active();
+Pixmap compositor_window_pixmap(Window id);
+int compositor_handle_event(XEvent *ev);
+void compositor_free();
+
+#endif /* COMPOSITOR_H */
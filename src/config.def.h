@@ -0,0 +1,27 @@
+// swm configuration; make copies this to config.h, edit that copy and rebuild
+
+// Key bindings: modifiers, keysym, action and its argument. Every binding is
+// grabbed with and without CapsLock and NumLock, which never affect matching.
+static const Key keys[] = {
+    // modifier                 key        function           argument
+    { Mod1Mask,                 XK_Tab,    key_switcher,      {0} },
+    { Mod1Mask,                 XK_F4,     key_call,          {.fn = close_window} },
+    { Mod4Mask,                 XK_q,      key_quit,          {0} },
+    { Mod4Mask | ShiftMask,     XK_r,      key_restart,       {0} },
+    { Mod4Mask,                 XK_d,      key_call,          {.fn = rundlg_show} },
+    { Mod4Mask,                 XK_n,      key_call,          {.fn = minimize_window} },
+    { Mod4Mask,                 XK_l,      key_call,          {.fn = lscreen_show} },
+    { Mod4Mask,                 XK_m,      key_call,          {.fn = maximize_window} },
+    { Mod4Mask,                 XK_r,      key_call,          {.fn = restore_window} },
+    { Mod4Mask,                 XK_x,      key_call,          {.fn = hide_window} },
+    { Mod4Mask,                 XK_z,      key_call,          {.fn = unhide_last_window} },
+    { Mod4Mask,                 XK_t,      key_call,          {.fn = cycle_layout} },
+    { Mod4Mask,                 XK_1,      key_desktop,       {.i = 0} },
+    { Mod4Mask,                 XK_2,      key_desktop,       {.i = 1} },
+    { Mod4Mask,                 XK_3,      key_desktop,       {.i = 2} },
+    { Mod4Mask,                 XK_4,      key_desktop,       {.i = 3} },
+    { Mod4Mask | ShiftMask,     XK_1,      key_send,          {.i = 0} },
+    { Mod4Mask | ShiftMask,     XK_2,      key_send,          {.i = 1} },
+    { Mod4Mask | ShiftMask,     XK_3,      key_send,          {.i = 2} },
+    { Mod4Mask | ShiftMask,     XK_4,      key_send,          {.i = 3} },
+};
@@ -0,0 +1,141 @@
+
+#include "evloop.h"
+#include "trace.h"
+
+static evwatch_t watches[MAX_WATCHES];
+static int watch_count = 0;
+static evtimer_t timers[MAX_TIMERS];
+static int timer_count = 0;
+static int next_timer_id = 1;
+
+/* Watch a file descriptor; fn runs on the main thread when it is readable */
+int evloop_add_fd(int fd, evloop_fn fn, void *arg) {
+	if (fd < 0 || watch_count >= MAX_WATCHES) return 0;
+	watches[watch_count].fd = fd;
+	watches[watch_count].fn = fn;
+	watches[watch_count].arg = arg;
+	watch_count++;
+	return 1;
+}
+
+/* Stop watching a file descriptor */
+void evloop_remove_fd(int fd) {
+	for (int i = 0; i < watch_count; i++) {
+		if (watches[i].fd == fd) {
+			watches[i] = watches[--watch_count];
+			return;
+		}
+	}
+}
+
+/* Whether a descriptor is still being watched */
+static int evloop_watched(int fd) {
+	for (int i = 0; i < watch_count; i++) {
+		if (watches[i].fd == fd) return 1;
+	}
+	return 0;
+}
+
+/* Schedule fn after delay_us; returns a timer id, or 0 if the table is full */
+int evloop_add_timer(long delay_us, evloop_timer_fn fn, void *arg) {
+	if (timer_count >= MAX_TIMERS) return 0;
+
+	evtimer_t *t = &timers[timer_count++];
+	clock_gettime(CLOCK_MONOTONIC, &t->deadline);
+	t->deadline.tv_sec += delay_us / 1000000L;
+	t->deadline.tv_nsec += (delay_us % 1000000L) * 1000L;
+	if (t->deadline.tv_nsec >= 1000000000L) {
+		t->deadline.tv_sec++;
+		t->deadline.tv_nsec -= 1000000000L;
+	}
+	t->fn = fn;
+	t->arg = arg;
+	t->id = next_timer_id++;
+	if (next_timer_id <= 0) next_timer_id = 1;
+	return t->id;
+}
+
+/* Drop a pending timer; unknown or already fired ids are ignored */
+void evloop_cancel_timer(int id) {
+	for (int i = 0; i < timer_count; i++) {
+		if (timers[i].id == id) {
+			timers[i] = timers[--timer_count];
+			return;
+		}
+	}
+}
+
+/* Microseconds until a deadline, negative once it has passed */
+static long evloop_until(const struct timespec *deadline, const struct timespec *now) {
+	return (deadline->tv_sec - now->tv_sec) * 1000000L + (deadline->tv_nsec - now->tv_nsec) / 1000L;
+}
+
+/* Run every timer whose deadline has passed */
+void evloop_run_timers() {
+	struct timespec now;
+	evtimer_t expired[MAX_TIMERS];
+	int n = 0;
+
+	if (timer_count == 0) return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	/* Unlink first: callbacks may schedule or cancel timers */
+	for (int i = 0; i < timer_count; ) {
+		if (evloop_until(&timers[i].deadline, &now) <= 0) {
+			expired[n++] = timers[i];
+			timers[i] = timers[--timer_count];
+		} else {
+			i++;
+		}
+	}
+	TRACE_BEGIN("timers");
+	for (int i = 0; i < n; i++) {
+		expired[i].fn(expired[i].arg);
+	}
+	TRACE_END("timers");
+}
+
+/* Poll timeout in milliseconds until the earliest timer, -1 if there is none */
+static int evloop_timeout() {
+	struct timespec now;
+	long earliest = -1;
+
+	if (timer_count == 0) return -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (int i = 0; i < timer_count; i++) {
+		long us = evloop_until(&timers[i].deadline, &now);
+		if (us < 0) us = 0;
+		if (earliest < 0 || us < earliest) earliest = us;
+	}
+	return (earliest + 999) / 1000;
+}
+
+/* Block until the X connection or a watched descriptor is readable, or a timer is due */
+void evloop_wait(int xfd) {
+	struct pollfd fds[MAX_WATCHES + 1];
+	evwatch_t ready[MAX_WATCHES];
+	int n = watch_count;
+
+	fds[0].fd = xfd;
+	fds[0].events = POLLIN;
+	for (int i = 0; i < n; i++) {
+		fds[i + 1].fd = watches[i].fd;
+		fds[i + 1].events = POLLIN;
+		ready[i] = watches[i];
+	}
+
+	TRACE_BEGIN("poll");
+	int ready_count = poll(fds, n + 1, evloop_timeout());
+	TRACE_END("poll");
+	evloop_run_timers();
+	if (ready_count <= 0) return;
+
+	/* Callbacks may add or remove watches, so run them from the snapshot */
+	for (int i = 0; i < n; i++) {
+		if ((fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) && evloop_watched(ready[i].fd)) {
+			TRACE_BEGIN("watch");
+			ready[i].fn(ready[i].fd, ready[i].arg);
+			TRACE_END("watch");
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <poll.h>
+#include <time.h>
+
+#define MAX_WATCHES 16
+#define MAX_TIMERS 32
+
+typedef void (*evloop_fn)(int fd, void *arg);
+typedef void (*evloop_timer_fn)(void *arg);
+
+/* Extra file descriptor serviced alongside the X connection */
+typedef struct _evwatch {
+	int fd;
+	evloop_fn fn;
+	void *arg;
+} evwatch_t;
+
+/* One-shot timer, run on the main thread once its deadline has passed */
+typedef struct _evtimer {
+	int id;
+	struct timespec deadline;
+	evloop_timer_fn fn;
+	void *arg;
+} evtimer_t;
+
+int evloop_add_fd(int fd, evloop_fn fn, void *arg);
+void evloop_remove_fd(int fd);
+int evloop_add_timer(long delay_us, evloop_timer_fn fn, void *arg);
+void evloop_cancel_timer(int id);
+void evloop_run_timers();
+void evloop_wait(int xfd);
+
+#endif /* EVLOOP_H */
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <string.h>
+#include <X11/Xatom.h>
+#include "frame.h"
+#include "settings.h"
+#include "redraw.h"
+#include "trace.h"
+
+/* Title bar background for one width class, pre-rendered for both focus states */
+typedef struct {
+	int width;
+	Pixmap pixmap[2];
+} size_class_t;
+
+static Display *dpy;
+static Window root;
+static int scr;
+static GC gc;
+static XFontStruct *font = NULL;
+static char font_name[SETTINGS_FONT_LEN];
+static unsigned long border_pixel[2];
+static Atom net_frame_extents, net_wm_name, utf8_string;
+static unsigned long shade[2][TITLE_HEIGHT];
+static unsigned long text_color[2];
+static size_class_t classes[FRAME_CLASSES];
+static int nclasses = 0;
+static int next_evict = 0;
+
+/* Blend two 0xRRGGBB colors and allocate the result */
+static unsigned long alloc_shade(unsigned long from, unsigned long to, int step, int steps) {
+	Colormap cmap = DefaultColormap(dpy, scr);
+	XColor c;
+	int r0 = (from >> 16) & 0xFF, g0 = (from >> 8) & 0xFF, b0 = from & 0xFF;
+	int r1 = (to >> 16) & 0xFF, g1 = (to >> 8) & 0xFF, b1 = to & 0xFF;
+
+	c.red = (r0 + (r1 - r0) * step / steps) * 257;
+	c.green = (g0 + (g1 - g0) * step / steps) * 257;
+	c.blue = (b0 + (b1 - b0) * step / steps) * 257;
+	c.flags = DoRed | DoGreen | DoBlue;
+	if (!XAllocColor(dpy, cmap, &c)) return BlackPixel(dpy, scr);
+	return c.pixel;
+}
+
+int frame_init(Display *display, int screen) {
+	dpy = display;
+	scr = screen;
+	root = RootWindow(dpy, scr);
+	gc = XCreateGC(dpy, root, 0, NULL);
+	net_frame_extents = XInternAtom(dpy, "_NET_FRAME_EXTENTS", False);
+	net_wm_name = XInternAtom(dpy, "_NET_WM_NAME", False);
+	utf8_string = XInternAtom(dpy, "UTF8_STRING", False);
+
+	frame_apply_settings(settings_get());
+	if (!font && (font = XLoadQueryFont(dpy, "fixed"))) XSetFont(dpy, gc, font->fid);
+	if (!font) {
+		XFreeGC(dpy, gc);
+		return 0;
+	}
+
+	/* Vertical gradients: index 0 is the inactive state, 1 the active one */
+	for (int i = 0; i < TITLE_HEIGHT; i++) {
+		shade[0][i] = alloc_shade(0x505050, 0x303030, i, TITLE_HEIGHT - 1);
+		shade[1][i] = alloc_shade(0x3A6EA5, 0x1E3F66, i, TITLE_HEIGHT - 1);
+	}
+	text_color[0] = alloc_shade(0xA0A0A0, 0xA0A0A0, 0, 1);
+	text_color[1] = WhitePixel(dpy, scr);
+	return 1;
+}
+
+/* Pick up border colors and the title font; a font that cannot be loaded
+ * leaves the current one in place */
+void frame_apply_settings(const Settings *s) {
+	border_pixel[0] = settings_pixel(dpy, scr, s->border_color_inactive);
+	border_pixel[1] = settings_pixel(dpy, scr, s->border_color);
+
+	if (font && !strcmp(font_name, s->font)) return;
+	XFontStruct *f = XLoadQueryFont(dpy, s->font);
+	if (!f) {
+		fprintf(stderr, "swm: cannot load font '%s'\n", s->font);
+		return;
+	}
+	if (font) XFreeFont(dpy, font);
+	font = f;
+	strcpy(font_name, s->font);
+	XSetFont(dpy, gc, font->fid);
+}
+
+/* Shared decoration pixmaps for a frame width, rendered on first use */
+static size_class_t *frame_class(int width) {
+	int cw = (width + FRAME_CLASS_STEP - 1) / FRAME_CLASS_STEP * FRAME_CLASS_STEP;
+	for (int i = 0; i < nclasses; i++) {
+		if (classes[i].width == cw) return &classes[i];
+	}
+
+	/* Reuse slots round robin once the table is full; frames hold their own copies */
+	size_class_t *sc;
+	if (nclasses < FRAME_CLASSES) {
+		sc = &classes[nclasses++];
+	} else {
+		sc = &classes[next_evict];
+		next_evict = (next_evict + 1) % FRAME_CLASSES;
+		XFreePixmap(dpy, sc->pixmap[0]);
+		XFreePixmap(dpy, sc->pixmap[1]);
+	}
+
+	sc->width = cw;
+	for (int a = 0; a < 2; a++) {
+		sc->pixmap[a] = XCreatePixmap(dpy, root, cw, TITLE_HEIGHT, DefaultDepth(dpy, scr));
+		for (int y = 0; y < TITLE_HEIGHT; y++) {
+			XSetForeground(dpy, gc, shade[a][y]);
+			XDrawLine(dpy, sc->pixmap[a], gc, 0, y, cw - 1, y);
+		}
+	}
+	return sc;
+}
+
+/* Build the frame's active and inactive title pixmaps from its class and cached title */
+static void frame_render(WindowNode *node) {
+	int width = node->gwidth > 0 ? node->gwidth : 1;
+	size_class_t *sc = frame_class(width);
+
+	if (node->pm_width != width) {
+		for (int a = 0; a < 2; a++) {
+			if (node->title_pm[a] != None) XFreePixmap(dpy, node->title_pm[a]);
+			node->title_pm[a] = XCreatePixmap(dpy, root, width, TITLE_HEIGHT, DefaultDepth(dpy, scr));
+		}
+		node->pm_width = width;
+	}
+
+	char text[sizeof(node->title) + sizeof(FRAME_HUNG_SUFFIX)];
+	int len = snprintf(text, sizeof(text), "%s%s", node->title, node->hung ? FRAME_HUNG_SUFFIX : "");
+	int text_y = (TITLE_HEIGHT + font->ascent - font->descent) / 2;
+	for (int a = 0; a < 2; a++) {
+		XCopyArea(dpy, sc->pixmap[a], node->title_pm[a], gc, 0, 0, width, TITLE_HEIGHT, 0, 0);
+		XSetForeground(dpy, gc, text_color[a]);
+		XDrawString(dpy, node->title_pm[a], gc, 4, text_y, text, len);
+	}
+
+	XSetWindowBackgroundPixmap(dpy, node->frame, node->title_pm[node->active]);
+	XClearArea(dpy, node->frame, 0, 0, width, TITLE_HEIGHT, False);
+	node->title_stale = 0;
+}
+
+/* Scheduled redraw: re-render a stale title, then show the border and title
+ * bar for the frame's focus state. However many focus or title changes came
+ * in since the last frame, the server sees only the final one. */
+static void frame_draw(void *arg) {
+	WindowNode *node = arg;
+	if (node->frame == None) return;
+
+	XSetWindowBorder(dpy, node->frame, border_pixel[node->active]);
+	if (node->title_stale) {
+		frame_render(node);
+		return;
+	}
+	XSetWindowBackgroundPixmap(dpy, node->frame, node->title_pm[node->active]);
+	XClearArea(dpy, node->frame, 0, 0, node->pm_width, TITLE_HEIGHT, False);
+}
+
+/* Titles are drawn with core fonts, which are ISO 8859-1: keep the code
+ * points they can show and replace the rest with '?' */
+static void frame_utf8_title(WindowNode *node, const unsigned char *s, unsigned long len) {
+	size_t n = 0;
+
+	for (unsigned long i = 0; i < len && s[i] && n < sizeof(node->title) - 1; ) {
+		unsigned long cp = s[i], extra = 0;
+		if (cp >= 0xF0) extra = 3, cp &= 0x07;
+		else if (cp >= 0xE0) extra = 2, cp &= 0x0F;
+		else if (cp >= 0xC0) extra = 1, cp &= 0x1F;
+		else if (cp >= 0x80) cp = '?';  /* Stray continuation byte */
+		i++;
+		for (; extra && i < len && (s[i] & 0xC0) == 0x80; extra--, i++) cp = cp << 6 | (s[i] & 0x3F);
+		node->title[n++] = extra || cp > 0xFF ? '?' : (char)cp;
+	}
+	node->title[n] = '\0';
+}
+
+/* Refresh the cached title from the client, preferring the UTF-8 _NET_WM_NAME */
+static void frame_fetch_title(WindowNode *node) {
+	unsigned char *data = NULL;
+	unsigned long n, after;
+	Atom type;
+	int format;
+
+	if (TRACE_X("XGetWindowProperty", XGetWindowProperty(dpy, node->window, net_wm_name, 0, sizeof(node->title),
+			False, utf8_string, &type, &format, &n, &after, &data)) == Success && data) {
+		int found = type == utf8_string && format == 8 && n > 0;
+		if (found) frame_utf8_title(node, data, n);
+		XFree(data);
+		if (found) return;
+	}
+
+	char *name = NULL;
+	node->title[0] = '\0';
+	if (TRACE_X("XFetchName", XFetchName(dpy, node->window, &name)) && name) {
+		strncpy(node->title, name, sizeof(node->title) - 1);
+		node->title[sizeof(node->title) - 1] = '\0';
+		XFree(name);
+	}
+}
+
+/* Advertise the decoration size to the client */
+static void frame_set_extents(WindowNode *node) {
+	long bw = settings_get()->border_width;
+	long extents[4] = { bw, bw, bw + TITLE_HEIGHT, bw };
+	XChangeProperty(dpy, node->window, net_frame_extents, XA_CARDINAL, 32,
+		PropModeReplace, (unsigned char *)extents, 4);
+}
+
+/* Wrap a client in a frame at the node's cached geometry. Reparenting a
+ * mapped client makes the server unmap it, which must not look like a withdrawal. */
+void frame_create(WindowNode *node, int mapped) {
+	node->title_pm[0] = node->title_pm[1] = None;
+	node->pm_width = 0;
+	node->active = 0;
+	node->title_stale = 0;
+
+	node->frame = XCreateSimpleWindow(dpy, root, node->gx, node->gy, node->gwidth, node->gheight,
+		settings_get()->border_width, border_pixel[0], BlackPixel(dpy, scr));
+	XSelectInput(dpy, node->frame, SubstructureRedirectMask | SubstructureNotifyMask | ButtonPressMask);
+	XSelectInput(dpy, node->window, PropertyChangeMask);
+
+	XAddToSaveSet(dpy, node->window);
+	XSetWindowBorderWidth(dpy, node->window, 0);
+	if (mapped) node->ignore_unmap++;
+	XReparentWindow(dpy, node->window, node->frame, 0, TITLE_HEIGHT);
+
+	frame_set_extents(node);
+
+	frame_fetch_title(node);
+	frame_render(node);
+}
+
+/* Drop the frame; a client that is still alive goes back to the root window */
+void frame_destroy(WindowNode *node, int reparent) {
+	if (node->frame == None) return;
+	redraw_forget(node);
+
+	if (reparent) {
+		XReparentWindow(dpy, node->window, root, node->gx, node->gy + TITLE_HEIGHT);
+		XRemoveFromSaveSet(dpy, node->window);
+	}
+	XDestroyWindow(dpy, node->frame);
+	node->frame = None;
+
+	for (int a = 0; a < 2; a++) {
+		if (node->title_pm[a] != None) XFreePixmap(dpy, node->title_pm[a]);
+		node->title_pm[a] = None;
+	}
+	node->pm_width = 0;
+}
+
+/* Follow a width change; heights never affect the title bar */
+void frame_resize(WindowNode *node) {
+	if (node->frame != None && node->gwidth != node->pm_width) {
+		frame_render(node);
+	}
+}
+
+void frame_update_title(WindowNode *node) {
+	frame_fetch_title(node);
+	node->title_stale = 1;
+	redraw_mark(frame_draw, node);
+}
+
+/* Focus changes only swap the background between the two pre-rendered pixmaps */
+void frame_set_active(WindowNode *node, int active) {
+	if (node->frame == None || node->active == active) return;
+
+	node->active = active;
+	redraw_mark(frame_draw, node);
+}
+
+/* Redo a frame's border and title after a settings change */
+void frame_refresh(WindowNode *node) {
+	if (node->frame == None) return;
+	XSetWindowBorderWidth(dpy, node->frame, settings_get()->border_width);
+	XSetWindowBorder(dpy, node->frame, border_pixel[node->active]);
+	frame_set_extents(node);
+	frame_render(node);
+}
+
+/* Clients that stop answering pings get a suffix in their title bar */
+void frame_set_hung(WindowNode *node, int hung) {
+	node->hung = hung;
+	node->title_stale = 1;
+	if (node->frame != None) redraw_mark(frame_draw, node);
+}
+
+void frame_free() {
+	for (int i = 0; i < nclasses; i++) {
+		XFreePixmap(dpy, classes[i].pixmap[0]);
+		XFreePixmap(dpy, classes[i].pixmap[1]);
+	}
+	nclasses = 0;
+	if (font) XFreeFont(dpy, font);
+	font = NULL;
+	if (gc) XFreeGC(dpy, gc);
+	gc = NULL;
+}
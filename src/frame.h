@@ -0,0 +1,25 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include "main.h"
+#include "settings.h"
+
+#define TITLE_HEIGHT 18
+#define FRAME_CLASS_STEP 128  /* Decoration pixmaps are shared per width rounded up to this */
+#define FRAME_CLASSES 32
+#define FRAME_HUNG_SUFFIX " (not responding)"
+
+int frame_init(Display *display, int screen);
+void frame_apply_settings(const Settings *s);
+void frame_create(WindowNode *node, int mapped);
+void frame_destroy(WindowNode *node, int reparent);
+void frame_resize(WindowNode *node);
+void frame_update_title(WindowNode *node);
+void frame_set_active(WindowNode *node, int active);
+void frame_set_hung(WindowNode *node, int hung);
+void frame_refresh(WindowNode *node);
+void frame_free();
+
+#endif /* FRAME_H */
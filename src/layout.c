@@ -0,0 +1,64 @@
+#include "layout.h"
+
+static const char *names[LAYOUT_COUNT] = {
+	[LAYOUT_FLOATING] = "floating",
+	[LAYOUT_MASTER_STACK] = "master-stack",
+	[LAYOUT_GRID] = "grid",
+};
+
+const char *layout_name(layout_t layout) {
+	return layout < LAYOUT_COUNT ? names[layout] : "unknown";
+}
+
+/* Split a span into n parts whose sizes differ by at most one pixel */
+static void split(int start, int size, int n, int i, int *pos, int *len) {
+	*pos = start + size * i / n;
+	*len = start + size * (i + 1) / n - *pos;
+}
+
+/* First window takes the left part, the rest share a column on the right */
+static void tile_master_stack(const Monitor *area, int n, Tile *out) {
+	if (n == 1) {
+		out[0] = (Tile){ area->x, area->y, area->width, area->height };
+		return;
+	}
+
+	int master = area->width * LAYOUT_MASTER_FACTOR;
+	out[0] = (Tile){ area->x, area->y, master, area->height };
+	for (int i = 1; i < n; i++) {
+		out[i].x = area->x + master;
+		out[i].width = area->width - master;
+		split(area->y, area->height, n - 1, i - 1, &out[i].y, &out[i].height);
+	}
+}
+
+/* Near-square grid, filled row by row; the last row stretches to the full width */
+static void tile_grid(const Monitor *area, int n, Tile *out) {
+	int cols = 1;
+	while (cols * cols < n) cols++;
+	int rows = (n + cols - 1) / cols;
+
+	for (int i = 0; i < n; i++) {
+		int row = i / cols;
+		int in_row = row == rows - 1 ? n - row * cols : cols;
+		split(area->x, area->width, in_row, i % cols, &out[i].x, &out[i].width);
+		split(area->y, area->height, rows, row, &out[i].y, &out[i].height);
+	}
+}
+
+/* Compute n tiles covering area; returns 0 for the floating layout */
+int layout_tile(layout_t layout, const Monitor *area, int n, Tile *out) {
+	if (n <= 0) return 0;
+
+	switch (layout) {
+		case LAYOUT_MASTER_STACK:
+			tile_master_stack(area, n, out);
+			break;
+		case LAYOUT_GRID:
+			tile_grid(area, n, out);
+			break;
+		default:
+			return 0;
+	}
+	return 1;
+}
@@ -0,0 +1,24 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "monitor.h"
+
+/* Tiling arrangements; LAYOUT_FLOATING leaves client geometry alone */
+typedef enum {
+	LAYOUT_FLOATING,
+	LAYOUT_MASTER_STACK,
+	LAYOUT_GRID,
+	LAYOUT_COUNT
+} layout_t;
+
+#define LAYOUT_MASTER_FACTOR 0.55
+
+/* Outer geometry of one tile, border included */
+typedef struct {
+	int x, y, width, height;
+} Tile;
+
+const char *layout_name(layout_t layout);
+int layout_tile(layout_t layout, const Monitor *area, int n, Tile *out);
+
+#endif /* LAYOUT_H */
@@ -1,42 +1,389 @@
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 #include "lscreen.h"
+#include "blur.h"
+#include "evloop.h"
+#include "monitor.h"
+#include "redraw.h"
+#include "settings.h"
+#include "trace.h"
 #include "util.h"
 
 static lscreen_t lscreen;
 
-/* Initialize the lock screen */
-int lscreen_init(Display *display, int screen) {
-	lscreen.display = display;
-	lscreen.screen = screen;
+/* Path of the password hash file */
+static void lscreen_hash_path(char *filename, size_t size) {
+	const char *home = getenv("HOME");
+	snprintf(filename, size, "%s/.swmhash", home ? home : ".");
+}
+
+/* Reject stored scrypt costs that would overflow N or exhaust memory or time */
+static int lscreen_params_valid(const swmhash_t *h) {
+	if (h->logn < 1 || h->logn > 30 || h->r < 1 || h->p < 1 || h->p > SCRYPT_MAX_P) return 0;
+	/* scrypt needs 128 * r * (N + p) bytes */
+	return 128 * (uint64_t)h->r * (((uint64_t)1 << h->logn) + h->p) <= SCRYPT_MAXMEM;
+}
 
-	/* Get the hash if not default to a hash */
+/* Load the password hash, falling back to a default one */
+static void lscreen_load_hash() {
 	const char *defhash = "password";
 	char filename[512] = {0};
-	snprintf(filename, sizeof(filename)-1, "%s/.swmhash", getenv("HOME"));
+	lscreen_hash_path(filename, sizeof(filename));
+
+	lscreen.kind = HASH_LEGACY_SHA512;
+	memset(&lscreen.stored, 0, sizeof(lscreen.stored));
+	lscreen.hash_valid = 1;
+
 	FILE *fp = fopen(filename, "rb");
-	if (!fp) {
-		SHA512((unsigned char *)defhash, strlen(defhash), lscreen.hash);
+	if (fp) {
+		unsigned char buf[sizeof(swmhash_t) + 1];
+		size_t size = fread(buf, 1, sizeof(buf), fp);
+		fclose(fp);
+		if (size == sizeof(swmhash_t) && !memcmp(buf, SWMHASH_MAGIC, 4)) {
+			memcpy(&lscreen.stored, buf, sizeof(swmhash_t));
+			if (lscreen_params_valid(&lscreen.stored)) {
+				lscreen.kind = HASH_SCRYPT;
+				return;
+			}
+			fprintf(stderr, "lscreen: %s: invalid scrypt parameters\n", filename);
+			memset(&lscreen.stored, 0, sizeof(lscreen.stored));
+		} else if (size == SHA512_DIGEST_LENGTH) {
+			memcpy(lscreen.stored.hash, buf, SHA512_DIGEST_LENGTH);
+			return;
+		}
+	}
+	SHA512((unsigned char *)defhash, strlen(defhash), lscreen.stored.hash);
+}
+
+/* Invalidate the cached hash when ~/.swmhash changes */
+static void lscreen_inotify(int fd, void *arg) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + len; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			if (ev->len && !strcmp(ev->name, ".swmhash")) {
+				lscreen.hash_valid = 0;
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+}
+
+/* Derive the hash for a job; salted scrypt or the legacy digest */
+static int lscreen_derive(const lscreen_job_t *job, unsigned char *out) {
+	if (job->kind == HASH_LEGACY_SHA512) {
+		SHA512((const unsigned char *)job->pass, job->len, out);
+		return 1;
+	}
+	return EVP_PBE_scrypt(job->pass, job->len, job->params.salt, SCRYPT_SALT_LEN,
+			(uint64_t)1 << job->params.logn, job->params.r, job->params.p,
+			SCRYPT_MAXMEM, out, SHA512_DIGEST_LENGTH);
+}
+
+/* Verification thread; reports the result through the pipe */
+static void *lscreen_verify(void *arg) {
+	lscreen_job_t *job = arg;
+	unsigned char hash[SHA512_DIGEST_LENGTH] = {0};
+	char ok = lscreen_derive(job, hash) &&
+		!CRYPTO_memcmp(job->params.hash, hash, SHA512_DIGEST_LENGTH);
+
+	OPENSSL_cleanse(hash, sizeof(hash));
+	OPENSSL_cleanse(job->pass, sizeof(job->pass));
+	if (write(lscreen.result_pipe[1], &ok, 1) != 1) {
+		perror("lscreen: write");
+	}
+	return NULL;
+}
+
+/* Release everything set up by lscreen_init_blur() */
+static void lscreen_free_blur() {
+	if (lscreen.snapshot) {
+		XShmDetach(lscreen.display, &lscreen.shminfo);
+		XDestroyImage(lscreen.snapshot);
+		shmdt(lscreen.shminfo.shmaddr);
+		lscreen.snapshot = NULL;
+	}
+	if (lscreen.small) {
+		XDestroyImage(lscreen.small);
+		lscreen.small = NULL;
+	}
+	if (lscreen.small_pict) XRenderFreePicture(lscreen.display, lscreen.small_pict);
+	if (lscreen.background_pict) XRenderFreePicture(lscreen.display, lscreen.background_pict);
+	if (lscreen.small_pixmap) XFreePixmap(lscreen.display, lscreen.small_pixmap);
+	if (lscreen.background) XFreePixmap(lscreen.display, lscreen.background);
+	lscreen.small_pict = lscreen.background_pict = None;
+	lscreen.small_pixmap = lscreen.background = None;
+	free(lscreen.scratch);
+	lscreen.scratch = NULL;
+	blur_free();
+}
+
+/* Allocate the capture and blur buffers once so locking does not have to */
+static void lscreen_init_blur() {
+	Display *dpy = lscreen.display;
+	Window root = RootWindow(dpy, lscreen.screen);
+	Visual *visual = DefaultVisual(dpy, lscreen.screen);
+	int depth = DefaultDepth(dpy, lscreen.screen);
+	int w = lscreen.width, h = lscreen.height;
+	int ev, err;
+
+	/* Capture through a shared memory segment when the server allows it */
+	if (XShmQueryExtension(dpy)) {
+		lscreen.snapshot = XShmCreateImage(dpy, visual, depth, ZPixmap, NULL, &lscreen.shminfo, w, h);
+		if (lscreen.snapshot) {
+			lscreen.shminfo.shmid = shmget(IPC_PRIVATE, lscreen.snapshot->bytes_per_line * h, IPC_CREAT | 0600);
+			lscreen.shminfo.shmaddr = lscreen.shminfo.shmid < 0 ? (char *)-1 : shmat(lscreen.shminfo.shmid, NULL, 0);
+			if (lscreen.shminfo.shmaddr == (char *)-1) {
+				XDestroyImage(lscreen.snapshot);
+				lscreen.snapshot = NULL;
+			} else {
+				lscreen.snapshot->data = lscreen.shminfo.shmaddr;
+				lscreen.shminfo.readOnly = False;
+				XShmAttach(dpy, &lscreen.shminfo);
+				XSync(dpy, False);
+			}
+			if (lscreen.shminfo.shmid >= 0) shmctl(lscreen.shminfo.shmid, IPC_RMID, NULL);
+		}
+	}
+
+	/* Blur at reduced resolution and let XRender scale it back up */
+	lscreen.scale = LOCK_BLUR_SCALE > 1 && XRenderQueryExtension(dpy, &ev, &err) ? LOCK_BLUR_SCALE : 1;
+	int sw = w / lscreen.scale, sh = h / lscreen.scale;
+
+	lscreen.scratch = malloc((size_t)sw * sh * 4);
+	lscreen.background = XCreatePixmap(dpy, root, w, h, depth);
+	if (!lscreen.scratch || !lscreen.background) {
+		lscreen_free_blur();
+		return;
+	}
+	blur_start(blur_threads());
+
+	if (lscreen.scale > 1) {
+		XRenderPictFormat *fmt = XRenderFindVisualFormat(dpy, visual);
+		char *data = malloc((size_t)sw * sh * 4);
+		if (!fmt || !data) {
+			free(data);
+			lscreen_free_blur();
+			return;
+		}
+		lscreen.small = XCreateImage(dpy, visual, depth, ZPixmap, 0, data, sw, sh, 32, 0);
+		lscreen.small_pixmap = XCreatePixmap(dpy, root, sw, sh, depth);
+
+		XRenderPictureAttributes pa;
+		pa.repeat = RepeatPad;
+		lscreen.small_pict = XRenderCreatePicture(dpy, lscreen.small_pixmap, fmt, CPRepeat, &pa);
+		lscreen.background_pict = XRenderCreatePicture(dpy, lscreen.background, fmt, 0, NULL);
+
+		XTransform xf = {{
+			{ XDoubleToFixed(1), XDoubleToFixed(0), XDoubleToFixed(0) },
+			{ XDoubleToFixed(0), XDoubleToFixed(1), XDoubleToFixed(0) },
+			{ XDoubleToFixed(0), XDoubleToFixed(0), XDoubleToFixed(lscreen.scale) }
+		}};
+		XRenderSetPictureTransform(dpy, lscreen.small_pict, &xf);
+		XRenderSetPictureFilter(dpy, lscreen.small_pict, FilterBilinear, NULL, 0);
+	}
+}
+
+/* Capture the screen and turn it into the blurred lock background */
+static void lscreen_snapshot() {
+	Display *dpy = lscreen.display;
+	Window root = RootWindow(dpy, lscreen.screen);
+	int w = lscreen.width, h = lscreen.height;
+	XImage *img = NULL;
+
+	if (lscreen.background == None) return;
+
+	if (lscreen.snapshot) {
+		if (TRACE_X("XShmGetImage", XShmGetImage(dpy, root, lscreen.snapshot, 0, 0, AllPlanes))) img = lscreen.snapshot;
+	} else {
+		TRACE_X_BEGIN("XGetImage");
+		img = XGetImage(dpy, root, 0, 0, w, h, AllPlanes, ZPixmap);
+		TRACE_X_END("XGetImage");
+	}
+
+	/* Never show a stale snapshot if this one failed */
+	if (!img || img->bits_per_pixel != 32) {
+		XSetWindowBackground(dpy, lscreen.window, BlackPixel(dpy, lscreen.screen));
+		if (img && img != lscreen.snapshot) XDestroyImage(img);
+		return;
+	}
+
+	uint32_t *pixels = (uint32_t *)img->data;
+	int stride = img->bytes_per_line / 4;
+	int threads = blur_threads();
+
+	int blurred;
+
+	if (lscreen.scale > 1) {
+		int sw = w / lscreen.scale, sh = h / lscreen.scale;
+		uint32_t *small = (uint32_t *)lscreen.small->data;
+		blur_downscale(pixels, w, h, stride, small, lscreen.scale, threads);
+		blurred = blur_image(small, lscreen.scratch, sw, sh, sw, LOCK_BLUR_RADIUS / lscreen.scale, LOCK_BLUR_PASSES, threads);
+		if (blurred) {
+			XPutImage(dpy, lscreen.small_pixmap, lscreen.gc, lscreen.small, 0, 0, 0, 0, sw, sh);
+			XRenderComposite(dpy, PictOpSrc, lscreen.small_pict, None, lscreen.background_pict, 0, 0, 0, 0, 0, 0, w, h);
+		}
+	} else {
+		blurred = blur_image(pixels, lscreen.scratch, w, h, stride, LOCK_BLUR_RADIUS, LOCK_BLUR_PASSES, threads);
+		if (blurred && img == lscreen.snapshot) {
+			XShmPutImage(dpy, lscreen.background, lscreen.gc, img, 0, 0, 0, 0, w, h, False);
+		} else if (blurred) {
+			XPutImage(dpy, lscreen.background, lscreen.gc, img, 0, 0, 0, 0, w, h);
+		}
+	}
+
+	/* An unblurred snapshot must not end up behind the lock */
+	if (blurred) {
+		XSetWindowBackgroundPixmap(dpy, lscreen.window, lscreen.background);
+	} else {
+		XSetWindowBackground(dpy, lscreen.window, BlackPixel(dpy, lscreen.screen));
+	}
+
+	if (img != lscreen.snapshot) XDestroyImage(img);
+}
+
+/* Clear the typed password */
+static void lscreen_reset_input() {
+	widget_textbox_clear(lscreen.wm, lscreen.input);
+}
+
+/* Unmap the lock screen and give input back */
+static void lscreen_hide() {
+	lscreen.active = 0;
+	lscreen.showing = 0;
+	lscreen_reset_input();
+	widget_set_focus(lscreen.wm, NULL);
+	widget_set_visible(lscreen.wm, lscreen.input, 0);
+	XUnmapWindow(lscreen.display, lscreen.window);
+
+	/* Ungrab input before restoring focus */
+	XUngrabKeyboard(lscreen.display, CurrentTime);
+	XUngrabPointer(lscreen.display, CurrentTime);
+	show_cursor(lscreen.display, lscreen.window);
+
+	/* Restore hotkeys and focus */
+	if (lscreen.prev_focused_win) {
+		XSetInputFocus(lscreen.display, lscreen.prev_focused_win, lscreen.prev_revert_to, CurrentTime);
+	} else {
+		XSetInputFocus(lscreen.display, RootWindow(lscreen.display, lscreen.screen), PointerRoot, CurrentTime);
+	}
+	XFlush(lscreen.display);
+}
+
+/* Scheduled redraw of the widgets invalidated since the last frame */
+static void lscreen_draw(void *arg) {
+	if (lscreen.active) widget_manager_flush(lscreen.wm);
+}
+
+/* Collect the verification result on the main thread */
+static void lscreen_result(int fd, void *arg) {
+	char ok = 0;
+	if (read(fd, &ok, 1) != 1) return;
+
+	pthread_join(lscreen.worker, NULL);
+	lscreen.verifying = 0;
+
+	if (ok) {
+		lscreen_hide();
 	} else {
-		fseek(fp, 0, SEEK_END);
-		size_t size = ftell(fp);
-		fseek(fp, 0, SEEK_SET);
-		if (size != SHA512_DIGEST_LENGTH) {
-			SHA512((unsigned char *)defhash, strlen(defhash), lscreen.hash);
+		lscreen_reset_input();
+		redraw_mark(lscreen_draw, NULL);
+	}
+}
+
+/* Hand the typed password to the verification thread */
+static void lscreen_submit() {
+	if (!lscreen.hash_valid) lscreen_load_hash();
+
+	memcpy(lscreen.job.pass, widget_get_text(lscreen.input), lscreen.input->text_len);
+	lscreen.job.len = lscreen.input->text_len;
+	lscreen.job.kind = lscreen.kind;
+	lscreen.job.params = lscreen.stored;
+
+	if (pthread_create(&lscreen.worker, NULL, lscreen_verify, &lscreen.job) != 0) {
+		fprintf(stderr, "Failed to create verification thread\n");
+		OPENSSL_cleanse(lscreen.job.pass, sizeof(lscreen.job.pass));
+		lscreen_reset_input();
+		return;
+	}
+	lscreen.verifying = 1;
+}
+
+/* Handle a key press while locked */
+static void lscreen_keypress(XEvent *ev) {
+	/* Input is frozen until the pending check answers */
+	if (lscreen.verifying) return;
+
+	KeySym key = XLookupKeysym(&ev->xkey, 0);
+	if (key == XK_Escape) {
+		if (!lscreen.showing) {
+			lscreen.showing = 1;
+			widget_set_visible(lscreen.wm, lscreen.input, 1);
+			widget_set_focus(lscreen.wm, lscreen.input);
 		} else {
-			fread(lscreen.hash, sizeof(uint8_t), SHA512_DIGEST_LENGTH, fp);
+			lscreen.showing = 0;
+			widget_set_visible(lscreen.wm, lscreen.input, 0);
+			widget_set_focus(lscreen.wm, NULL);
+			XSetInputFocus(lscreen.display, lscreen.window, RevertToParent, CurrentTime);
 		}
-		fclose(fp);
+		lscreen_reset_input();
+	} else if (key == XK_Return) {
+		/* Accept input field entry */
+		if (lscreen.showing) {
+			lscreen_submit();
+		}
+	} else if (lscreen.showing) {
+		/* Everything else edits the password field, wherever focus is */
+		ev->xkey.window = lscreen.window;
+		widget_manager_handle_event(lscreen.wm, ev);
 	}
+}
 
-	/* Store the current focused window before locking */
-	XGetInputFocus(display, &lscreen.prev_focused_win, &lscreen.prev_revert_to);
+/* Create the lock screen once; it stays unmapped until shown */
+int lscreen_init(Display *display, int screen) {
+	lscreen.display = display;
+	lscreen.screen = screen;
+	lscreen.inotify_fd = -1;
+	lscreen.result_pipe[0] = lscreen.result_pipe[1] = -1;
+
+	/* Verification results come back through this pipe */
+	if (pipe(lscreen.result_pipe) != 0) return 0;
+	fcntl(lscreen.result_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(lscreen.result_pipe[1], F_SETFD, FD_CLOEXEC);
+	evloop_add_fd(lscreen.result_pipe[0], lscreen_result, NULL);
+
+	/* Cache the hash and watch its directory for changes */
+	lscreen_load_hash();
+	lscreen.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (lscreen.inotify_fd >= 0) {
+		const char *home = getenv("HOME");
+		if (home && inotify_add_watch(lscreen.inotify_fd, home, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE) >= 0) {
+			evloop_add_fd(lscreen.inotify_fd, lscreen_inotify, NULL);
+		} else {
+			close(lscreen.inotify_fd);
+			lscreen.inotify_fd = -1;
+		}
+	}
 
-	/* Create the simple window */
-	XWindowAttributes wa;
-	if (!XGetWindowAttributes(display, RootWindow(display, screen), &wa)) return 0;
-	lscreen.window = XCreateSimpleWindow(display, RootWindow(display, screen), 0, 0, wa.width, wa.height, 1, 0, BlackPixel(display, screen));
+	/* Create the simple window, covering every output */
+	monitor_screen_size(&lscreen.width, &lscreen.height);
+	lscreen.window = XCreateSimpleWindow(display, RootWindow(display, screen), 0, 0, lscreen.width, lscreen.height, 1, 0, BlackPixel(display, screen));
 	if (lscreen.window == None) return 0;
 	XSelectInput(display, lscreen.window, ExposureMask | KeyPressMask);
 
+	/* Set override redirect */
+	XSetWindowAttributes swa;
+	swa.override_redirect = True;
+	XChangeWindowAttributes(lscreen.display, lscreen.window, CWOverrideRedirect, &swa);
+
 	/* Create the graphics context for window */
 	lscreen.gc = XCreateGC(lscreen.display, lscreen.window, 0, NULL);
 	if (!lscreen.gc) {
@@ -44,133 +391,190 @@ int lscreen_init(Display *display, int screen) {
 		return 0;
 	}
 
-	/* Create the font */
-	lscreen.font = XLoadQueryFont(lscreen.display, "fixed");
-	if (lscreen.font) {
-		XSetFont(display, lscreen.gc, lscreen.font->fid);
+	/* Pre-allocate the snapshot buffers, only if they will be used */
+	if (settings_get()->lock_blur) {
+		lscreen_init_blur();
 	}
 
-	lscreen.input_field = XCreateSimpleWindow(display, lscreen.window, wa.width / 2 - 50, wa.height / 2 - 10, 100, 20, 1, 0, WhitePixel(display, screen));
-	if (!lscreen.input_field) {
+	/* The password field is a masked toolkit textbox, placed on the primary output when shown */
+	lscreen.wm = widget_manager_create(display);
+	lscreen.input = lscreen.wm ? widget_create_textbox(lscreen.wm, lscreen.window, 0, 0, 100, 20, MAXPASS - 1) : NULL;
+	if (!lscreen.input) {
+		if (lscreen.wm) widget_manager_destroy(lscreen.wm);
+		lscreen_free_blur();
+		XFreeGC(display, lscreen.gc);
 		XDestroyWindow(display, lscreen.window);
+		lscreen.window = None;
 		return 0;
 	}
-	XSelectInput(display, lscreen.input_field, KeyPressMask);
-
-	/* Set override redirect */
-	XSetWindowAttributes swa;
-	swa.override_redirect = True;
-	XChangeWindowAttributes(lscreen.display, lscreen.window, CWOverrideRedirect, &swa);
+	lscreen.input->masked = 1;
+	widget_set_visible(lscreen.wm, lscreen.input, 0);
 
-	memset(lscreen.input_text, 0, sizeof(lscreen.input_text)-1);
-	lscreen.input_len = 0;
+	lscreen_reset_input();
 	return 1;
 }
 
-/* Run the main loop */
+/* Follow screen layout changes since the lock window was created */
+static void lscreen_update_geometry() {
+	int width, height;
+	monitor_screen_size(&width, &height);
+	if (width != lscreen.width || height != lscreen.height) {
+		lscreen.width = width;
+		lscreen.height = height;
+		XResizeWindow(lscreen.display, lscreen.window, width, height);
+		lscreen_free_blur();
+	}
+
+	/* lock_blur may have been toggled by a settings reload since the last lock */
+	if (!settings_get()->lock_blur) {
+		lscreen_free_blur();
+		XSetWindowBackground(lscreen.display, lscreen.window, BlackPixel(lscreen.display, lscreen.screen));
+	} else if (lscreen.background == None) {
+		lscreen_init_blur();
+	}
+
+	Monitor mon = monitor_get(0);
+	widget_move(lscreen.wm, lscreen.input, mon.x + mon.width / 2 - lscreen.input->width / 2,
+		mon.y + mon.height / 2 - lscreen.input->height / 2);
+}
+
+/* Reset and map the lock screen; events are then fed by lscreen_handle_event() */
 void lscreen_show() {
-	char mask[MAXPASS] = {0};
+	if (lscreen.active) return;
+
+#ifdef TIMING
+	struct timespec start;
+	timer_start(&start);
+#endif
+
+	/* Reset state left over from the previous lock */
+	lscreen_reset_input();
+	lscreen.showing = 0;
+	lscreen_update_geometry();
+
+	/* Store the current focused window before locking */
+	TRACE_X("XGetInputFocus", XGetInputFocus(lscreen.display, &lscreen.prev_focused_win, &lscreen.prev_revert_to));
+
+	/* Snapshot the screen before the lock window covers it */
+	if (settings_get()->lock_blur) {
+		lscreen_snapshot();
+#ifdef TIMING
+		fprintf(stderr, "lscreen: snapshot blurred in %ld us\n", timer_elapsed_us(&start));
+#endif
+	}
 
 	/* Grab input */
-	XGrabKeyboard(lscreen.display, RootWindow(lscreen.display, lscreen.screen), True, GrabModeAsync, GrabModeAsync, CurrentTime);
-	XGrabPointer(lscreen.display, RootWindow(lscreen.display, lscreen.screen), True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
+	TRACE_X("XGrabKeyboard", XGrabKeyboard(lscreen.display, RootWindow(lscreen.display, lscreen.screen), True, GrabModeAsync, GrabModeAsync, CurrentTime));
+	TRACE_X("XGrabPointer", XGrabPointer(lscreen.display, RootWindow(lscreen.display, lscreen.screen), True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None, None, CurrentTime));
 
 	/* Display the window */
+	hide_cursor(lscreen.display, lscreen.window);
 	XMapRaised(lscreen.display, lscreen.window);
 	XSetInputFocus(lscreen.display, lscreen.window, RevertToParent, CurrentTime);
-	XSync(lscreen.display, False);
+	lscreen.active = 1;
 
-	hide_cursor(lscreen.display, lscreen.window);
+#ifdef TIMING
+	XSync(lscreen.display, False);
+	fprintf(stderr, "lscreen: shown in %ld us\n", timer_elapsed_us(&start));
+#else
 	XFlush(lscreen.display);
+#endif
+}
 
-	XEvent ev;
-	int showing = 0;
-	for (;;) {
-		XNextEvent(lscreen.display, &ev);
-		if (ev.type == Expose) {
-			XClearWindow(lscreen.display, lscreen.input_field);
-			XDrawString(lscreen.display, lscreen.input_field, lscreen.gc, 5, 12, mask, lscreen.input_len);
-			XFlush(lscreen.display);
-		} else if (ev.type == KeyPress) {
-			KeySym key = XLookupKeysym(&ev.xkey, 0);
-			if (key == XK_Escape) {
-				if (!showing) {
-					showing = 1;
-					XMapRaised(lscreen.display, lscreen.input_field);
-					XSetInputFocus(lscreen.display, lscreen.input_field, RevertToParent, CurrentTime);
-					XSync(lscreen.display, False);
-					memset(lscreen.input_text, 0, sizeof(lscreen.input_text));
-					memset(mask, 0, sizeof(mask));
-					lscreen.input_len = 0;
-				} else {
-					showing = 0;
-					XUnmapWindow(lscreen.display, lscreen.input_field);
-					XSetInputFocus(lscreen.display, lscreen.window, RevertToParent, CurrentTime);
-					XSync(lscreen.display, False);
-					memset(lscreen.input_text, 0, sizeof(lscreen.input_text));
-					memset(mask, 0, sizeof(mask));
-					lscreen.input_len = 0;
-				}
-			} else if (key == XK_Return) {
-				/* Accept input field entry */
-				if (showing) {
-					unsigned char hash[SHA512_DIGEST_LENGTH] = {0};
-					SHA512((unsigned char *)lscreen.input_text, lscreen.input_len, hash);
-					if (!memcmp(lscreen.hash, hash, SHA512_DIGEST_LENGTH)) {
-						break;
-					} else {
-						memset(lscreen.input_text, 0, sizeof(lscreen.input_text)-1);
-						lscreen.input_len = 0;
-					}
-				}
-			} else if (key == XK_BackSpace && lscreen.input_len > 0) {
-				lscreen.input_text[--lscreen.input_len] = '\0';
-			} else if (lscreen.input_len < (int)(sizeof(lscreen.input_text)-1) && key >= XK_space && key <= XK_asciitilde) {
-				/* Handle input field */
-				if (showing) {
-					char buffer[10];
-					XComposeStatus compose;
-					int len = XLookupString(&ev.xkey, buffer, sizeof(buffer)-1, &key, &compose);
-					buffer[len] = '\0';
-					mask[lscreen.input_len] = '*';
-					lscreen.input_text[lscreen.input_len++] = buffer[0];
-					mask[lscreen.input_len] = '\0';
-					lscreen.input_text[lscreen.input_len] = '\0';
-				}
-			}
+/* Whether the screen is currently locked */
+int lscreen_active() {
+	return lscreen.active;
+}
 
-			XClearWindow(lscreen.display, lscreen.input_field);
-			XDrawString(lscreen.display, lscreen.input_field, lscreen.gc, 5, 12, mask, lscreen.input_len);
-			XFlush(lscreen.display);
-		}
+/* Keep the lock screen above windows mapped while locked */
+void lscreen_raise() {
+	if (!lscreen.active) return;
+	XRaiseWindow(lscreen.display, lscreen.window);
+	XSetInputFocus(lscreen.display, lscreen.window, RevertToParent, CurrentTime);
+}
+
+/* Dispatch an event from the main loop; returns 1 if the lock screen consumed it */
+int lscreen_handle_event(XEvent *ev) {
+	if (!lscreen.active) return 0;
+
+	switch (ev->type) {
+		case KeyPress:
+			lscreen_keypress(ev);
+			break;
+		case KeyRelease:
+		case ButtonPress:
+		case ButtonRelease:
+		case MotionNotify:
+			/* Input is grabbed by the lock screen */
+			break;
+		default:
+			if (!widget_manager_handle_event(lscreen.wm, ev) && ev->xany.window != lscreen.window) return 0;
+			break;
 	}
 
-	/* Ungrab input before restoring focus */
-	XUngrabKeyboard(lscreen.display, CurrentTime);
-	XUngrabPointer(lscreen.display, CurrentTime);
+	/* Repaint only what the event invalidated, once per frame */
+	if (lscreen.active) redraw_mark(lscreen_draw, NULL);
+	return 1;
+}
 
-	/* Set override redirect */
-	XSetWindowAttributes swa;
-	swa.override_redirect = False;
-	XChangeWindowAttributes(lscreen.display, lscreen.window, CWOverrideRedirect, &swa);
+/* Write a salted scrypt hash of password to ~/.swmhash */
+int lscreen_write_hash(const char *password) {
+	lscreen_job_t job;
+	char filename[512] = {0};
 
-	show_cursor(lscreen.display, lscreen.window);
-	XFlush(lscreen.display);
+	memset(&job, 0, sizeof(job));
+	memcpy(job.params.magic, SWMHASH_MAGIC, 4);
+	job.params.logn = SCRYPT_LOGN;
+	job.params.r = SCRYPT_R;
+	job.params.p = SCRYPT_P;
+	job.kind = HASH_SCRYPT;
+	job.len = strlen(password);
+	if (job.len >= MAXPASS) {
+		fprintf(stderr, "Password must be shorter than %d characters\n", MAXPASS);
+		return 0;
+	}
+	memcpy(job.pass, password, job.len);
 
-	/* Restore hotkeys and focus */
-	if (lscreen.prev_focused_win) {
-		XSetInputFocus(lscreen.display, lscreen.prev_focused_win, lscreen.prev_revert_to, CurrentTime);
-	} else {
-		XSetInputFocus(lscreen.display, RootWindow(lscreen.display, lscreen.screen), PointerRoot, CurrentTime);
+	if (RAND_bytes(job.params.salt, SCRYPT_SALT_LEN) != 1 || !lscreen_derive(&job, job.params.hash)) {
+		fprintf(stderr, "Cannot derive password hash\n");
+		OPENSSL_cleanse(&job, sizeof(job));
+		return 0;
 	}
-	XFlush(lscreen.display);
+	OPENSSL_cleanse(job.pass, sizeof(job.pass));
+
+	lscreen_hash_path(filename, sizeof(filename));
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0 || write(fd, &job.params, sizeof(job.params)) != sizeof(job.params)) {
+		perror(filename);
+		if (fd >= 0) close(fd);
+		return 0;
+	}
+	close(fd);
+	return 1;
 }
 
 /* Free the lock screen */
 void lscreen_free() {
+	if (!lscreen.display) return;
+	if (lscreen.verifying) {
+		pthread_join(lscreen.worker, NULL);
+		lscreen.verifying = 0;
+	}
+	if (lscreen.inotify_fd >= 0) {
+		evloop_remove_fd(lscreen.inotify_fd);
+		close(lscreen.inotify_fd);
+		lscreen.inotify_fd = -1;
+	}
+	if (lscreen.result_pipe[0] >= 0) {
+		evloop_remove_fd(lscreen.result_pipe[0]);
+		close(lscreen.result_pipe[0]);
+		close(lscreen.result_pipe[1]);
+		lscreen.result_pipe[0] = lscreen.result_pipe[1] = -1;
+	}
+	if (lscreen.window == None) return;
+	lscreen_free_blur();
 	XFreeGC(lscreen.display, lscreen.gc);
-	XFreeFont(lscreen.display, lscreen.font);
-	XDestroyWindow(lscreen.display, lscreen.input_field);
+	widget_manager_destroy(lscreen.wm);
 	XDestroyWindow(lscreen.display, lscreen.window);
+	lscreen.window = None;
 }
-
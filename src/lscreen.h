@@ -4,31 +4,98 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/keysym.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xrender.h>
 #include <openssl/sha.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "widgets.h"
 
 #define MAXPASS 16
 
+/* scrypt cost used when writing a new ~/.swmhash (N = 1 << SCRYPT_LOGN) */
+#define SCRYPT_LOGN 15
+#define SCRYPT_R 8
+#define SCRYPT_P 1
+#define SCRYPT_SALT_LEN 16
+#define SCRYPT_MAXMEM (256 * 1024 * 1024)
+#define SCRYPT_MAX_P 16	/* upper bound accepted from a stored hash */
+
+#define SWMHASH_MAGIC "SWM1"
+
+/* Default for the lock_blur setting: a blurred snapshot of the screen as the lock background */
+#define LOCK_BLUR 0
+#define LOCK_BLUR_RADIUS 16	/* in screen pixels */
+#define LOCK_BLUR_PASSES 3	/* three box passes approximate a Gaussian */
+#define LOCK_BLUR_SCALE 4	/* blur at 1/4 resolution, upscaled by XRender */
+
+/* Hash file kinds; legacy files hold a bare unsalted SHA512 digest */
+typedef enum {
+	HASH_LEGACY_SHA512,
+	HASH_SCRYPT
+} hash_kind_t;
+
+/* On-disk layout of a salted ~/.swmhash */
+typedef struct _swmhash {
+	char magic[4];
+	uint8_t logn;
+	uint8_t r;
+	uint8_t p;
+	uint8_t pad;
+	unsigned char salt[SCRYPT_SALT_LEN];
+	unsigned char hash[SHA512_DIGEST_LENGTH];
+} swmhash_t;
+
+/* Password check handed to the verification thread */
+typedef struct _lscreen_job {
+	char pass[MAXPASS];
+	int len;
+	hash_kind_t kind;
+	swmhash_t params;
+} lscreen_job_t;
+
 typedef struct _lscreen {
 	Display *display;
 	int screen;
 	GC gc;
-	XFontStruct *font;
+	WidgetManager *wm;
+	Widget *input;
 	Window window;
-	Window input_field;
 	Window prev_focused_win;
-	unsigned char hash[SHA512_DIGEST_LENGTH];
-	char input_text[MAXPASS];
-	int input_len;
+	XImage *snapshot;
+	XShmSegmentInfo shminfo;
+	XImage *small;
+	uint32_t *scratch;
+	Pixmap background;
+	Pixmap small_pixmap;
+	Picture background_pict;
+	Picture small_pict;
+	int width;
+	int height;
+	int scale;
+	hash_kind_t kind;
+	swmhash_t stored;
+	int hash_valid;
+	int inotify_fd;
+	int result_pipe[2];
+	pthread_t worker;
+	lscreen_job_t job;
 	int prev_revert_to;
+	int active;
+	int showing;
+	int verifying;
 } lscreen_t;
 
 int lscreen_init(Display *d, int screen);
 void lscreen_show();
+int lscreen_active();
+void lscreen_raise();
+int lscreen_handle_event(XEvent *ev);
+int lscreen_write_hash(const char *password);
 void lscreen_free();
 
 #endif /* LSCREEN_H */
-
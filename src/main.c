@@ -6,11 +6,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <signal.h>
+#include <locale.h>
 #include "util.h"
 #include "lscreen.h"
 #include "status.h"
 #include "rundlg.h"
+#include "evloop.h"
+#include "monitor.h"
+#include "layout.h"
+#include "frame.h"
+#include "syncreq.h"
+#include "compositor.h"
+#include "switcher.h"
+#include "ping.h"
+#include "settings.h"
+#include "rules.h"
+#include "redraw.h"
+#include "trace.h"
+#include "audit.h"
 #include "main.h"
 
 // Global variables
@@ -24,35 +40,151 @@ Window minimized_windows[MAX_MINIMIZED];
 int minimized_count = 0;
 int hidden_count = 0;
 int running = 1;
+int restarting = 0;
+static char **saved_argv;
+static volatile sig_atomic_t signalled = 0;
+static int signal_pipe[2] = { -1, -1 };
+layout_t layout = LAYOUT_FLOATING;
+int current_desktop = 0;
+
+// Interactive move/resize in progress
+typedef enum { DRAG_NONE, DRAG_MOVE, DRAG_RESIZE } DragMode;
+static struct {
+    DragMode mode;
+    WindowNode *node;
+    int start_x, start_y;          // Pointer position at the button press
+    int x, y, width, height;       // Frame geometry at the button press
+    int px, py;                    // Latest pointer position
+    int pending;                   // px/py not applied yet
+    int timer;                     // Deferred apply when rate limited
+    struct timespec last;          // When geometry was last sent
+} drag;
+static Cursor move_cursor, resize_cursor;
+
+#define DRAG_MIN_SIZE 32
+int layout_dirty = 0;
 
 // EWMH atoms
 Atom net_supported, net_client_list, net_active_window, net_wm_name;
 Atom net_wm_state, net_wm_state_maximized_vert, net_wm_state_maximized_horz;
-Atom net_wm_state_hidden, net_wm_desktop, net_current_desktop;
+Atom net_wm_state_hidden, net_wm_desktop, net_current_desktop, net_number_of_desktops;
 Atom wm_protocols, wm_delete_window;
+Atom swm_restart_state;
+
+// Window state handed from one swm process to the next on restart: a header,
+// one record per window in list order, then the minimized and hidden stacks
+#define RESTART_MAGIC 0x53574D52  // "SWMR"
+#define RESTART_VERSION 1
+#define RESTART_HEADER 8
+#define RESTART_RECORD 11
+#define RESTART_MAX_LONGS (RESTART_HEADER + MAX_WINDOWS * RESTART_RECORD + MAX_MINIMIZED + MAX_HIDDEN)
 
 // Function prototypes
 void init_ewmh();
 void update_client_list();
 void update_active_window(Window win);
 WindowNode* find_window(Window win);
+WindowNode* find_frame(Window frame);
+int is_visible(WindowNode *node);
 WindowNode* add_window(Window win);
 void remove_window(Window win);
 void focus_window(WindowNode *node);
+void configure_node(WindowNode *node, int x, int y, int width, int height);
+void sync_ready(WindowNode *node);
+void arrange();
+void cycle_layout();
+void switch_desktop(int desktop);
+void send_to_desktop(int desktop);
+void drag_start(WindowNode *node, DragMode mode, XButtonEvent *e);
+void drag_motion(XMotionEvent *e);
+void drag_end();
 void next_window();
+void show_switcher(unsigned int mods);
+void window_damaged(Window frame);
 void close_window();
 void minimize_window();
+void set_maximized(WindowNode *node, int on);
 void maximize_window();
+void restore_window();
 void hide_window();
 void unhide_last_window();
 void handle_keypress(XKeyEvent *e);
 void handle_map_request(XMapRequestEvent *e);
 void handle_unmap_notify(XUnmapEvent *e);
 void handle_destroy_notify(XDestroyWindowEvent *e);
+void update_size_hints(WindowNode *node);
 void handle_configure_request(XConfigureRequestEvent *e);
+void handle_button_press(XButtonEvent *e);
+void handle_event(XEvent *e);
+void save_state();
+void adopt_windows();
 void cleanup();
 void signal_handler(int sig);
 
+// Key bindings, defined in config.h
+typedef union {
+    int i;
+    void (*fn)(void);
+} Arg;
+
+typedef struct {
+    unsigned int mod;
+    KeySym keysym;
+    void (*func)(const Arg *arg);
+    Arg arg;
+} Key;
+
+void key_call(const Arg *arg);
+void key_switcher(const Arg *arg);
+void key_quit(const Arg *arg);
+void key_desktop(const Arg *arg);
+void key_send(const Arg *arg);
+void key_restart(const Arg *arg);
+void grab_keys();
+void apply_settings(const Settings *old, const Settings *cur, int changed);
+
+#include "config.h"
+
+// Modifiers that distinguish bindings; lock modifiers are masked out
+#define MOD_COMBOS 16
+#define KEYCODES 256
+
+// Binding for each keycode and modifier combination, rebuilt on MappingNotify
+static const Key *keymap[KEYCODES][MOD_COMBOS];
+static Key config_keys[SETTINGS_MAX_BINDINGS];  // Bindings from the config file
+static const Key *key_active;  // Binding being dispatched, for actions that depend on its modifiers
+
+#if defined(TIMING) || defined(TRACE) || defined(AUDIT)
+static const char *event_names[LASTEvent] = {
+    [KeyPress] = "KeyPress", [KeyRelease] = "KeyRelease",
+    [ButtonPress] = "ButtonPress", [ButtonRelease] = "ButtonRelease",
+    [MotionNotify] = "MotionNotify", [EnterNotify] = "EnterNotify",
+    [LeaveNotify] = "LeaveNotify", [FocusIn] = "FocusIn", [FocusOut] = "FocusOut",
+    [Expose] = "Expose", [CreateNotify] = "CreateNotify",
+    [DestroyNotify] = "DestroyNotify", [UnmapNotify] = "UnmapNotify",
+    [MapNotify] = "MapNotify", [MapRequest] = "MapRequest",
+    [ReparentNotify] = "ReparentNotify", [ConfigureNotify] = "ConfigureNotify",
+    [ConfigureRequest] = "ConfigureRequest", [PropertyNotify] = "PropertyNotify",
+    [ClientMessage] = "ClientMessage", [MappingNotify] = "MappingNotify",
+};
+#endif
+
+#ifdef TIMING
+// Per event type handling latency, reported on exit
+static long event_count[LASTEvent];
+static long event_total_ns[LASTEvent];
+static long event_max_ns[LASTEvent];
+
+void report_event_latency();
+
+// ConfigureRequests from managed clients and what became of them, reported on exit
+static long configure_requests;   // Handled, after coalescing
+static long configure_coalesced;  // Folded into a later queued request
+static long configure_noop;       // Asked for the geometry the window already has
+static long configure_refused;    // Maximized or tiled, answered without moving
+static long configure_applied;    // Reached the server
+#endif
+
 // Initialize EWMH support
 void init_ewmh() {
     // Create atoms
@@ -66,22 +198,28 @@ void init_ewmh() {
     net_wm_state_hidden = XInternAtom(dpy, "_NET_WM_STATE_HIDDEN", False);
     net_wm_desktop = XInternAtom(dpy, "_NET_WM_DESKTOP", False);
     net_current_desktop = XInternAtom(dpy, "_NET_CURRENT_DESKTOP", False);
+    net_number_of_desktops = XInternAtom(dpy, "_NET_NUMBER_OF_DESKTOPS", False);
     wm_protocols = XInternAtom(dpy, "WM_PROTOCOLS", False);
     wm_delete_window = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
+    swm_restart_state = XInternAtom(dpy, "_SWM_RESTART_STATE", False);
 
     // Set supported atoms
     Atom supported[] = {
         net_supported, net_client_list, net_active_window, net_wm_name,
         net_wm_state, net_wm_state_maximized_vert, net_wm_state_maximized_horz,
-        net_wm_state_hidden, net_wm_desktop, net_current_desktop
+        net_wm_state_hidden, net_wm_desktop, net_current_desktop,
+        net_number_of_desktops, syncreq_atom(), ping_atom()
     };
     
     XChangeProperty(dpy, root, net_supported, XA_ATOM, 32,
                    PropModeReplace, (unsigned char*)supported,
                    sizeof(supported) / sizeof(Atom));
 
-    // Set current desktop to 0
-    long desktop = 0;
+    // Start on the first of NUM_DESKTOPS desktops
+    long desktops = NUM_DESKTOPS;
+    XChangeProperty(dpy, root, net_number_of_desktops, XA_CARDINAL, 32,
+                   PropModeReplace, (unsigned char*)&desktops, 1);
+    long desktop = current_desktop;
     XChangeProperty(dpy, root, net_current_desktop, XA_CARDINAL, 32,
                    PropModeReplace, (unsigned char*)&desktop, 1);
 }
@@ -120,6 +258,20 @@ WindowNode* find_window(Window win) {
     return NULL;
 }
 
+// Find the client whose frame this is
+WindowNode* find_frame(Window frame) {
+    for (WindowNode *node = window_list; node; node = node->next) {
+        if (node->frame == frame) return node;
+    }
+    return NULL;
+}
+
+// Whether a window is shown on the current desktop
+int is_visible(WindowNode *node) {
+    return node->desktop == current_desktop &&
+           node->state != WIN_HIDDEN && node->state != WIN_MINIMIZED;
+}
+
 // Add window to linked list
 WindowNode* add_window(Window win) {
     WindowNode *node = malloc(sizeof(WindowNode));
@@ -127,6 +279,15 @@ WindowNode* add_window(Window win) {
     
     node->window = win;
     node->state = WIN_NORMAL;
+    node->desktop = current_desktop;
+    node->ignore_unmap = 0;
+    node->frame = None;
+    node->thumb = None;
+    node->thumb_dirty = 0;
+    node->hung = 0;
+    node->ping_closing = 0;
+    node->close_hung = 0;
+    update_size_hints(node);
     node->next = window_list;
     node->prev = NULL;
     
@@ -135,16 +296,20 @@ WindowNode* add_window(Window win) {
     }
     window_list = node;
     
-    // Get window geometry
+    // Cached geometry is the frame's: the client plus the title bar above it
     XWindowAttributes attrs;
-    XGetWindowAttributes(dpy, win, &attrs);
-    node->x = attrs.x;
-    node->y = attrs.y;
-    node->width = attrs.width;
-    node->height = attrs.height;
+    TRACE_X("XGetWindowAttributes", XGetWindowAttributes(dpy, win, &attrs));
+    node->x = node->gx = attrs.x;
+    node->y = node->gy = attrs.y;
+    node->width = node->gwidth = attrs.width;
+    node->height = node->gheight = attrs.height + TITLE_HEIGHT;
+    frame_create(node, attrs.map_state != IsUnmapped);
+    syncreq_manage(node);
+    ping_manage(node);
+    node->pending = 0;
     
     // Set desktop property
-    long desktop = 0;
+    long desktop = node->desktop;
     XChangeProperty(dpy, win, net_wm_desktop, XA_CARDINAL, 32,
                    PropModeReplace, (unsigned char*)&desktop, 1);
     
@@ -169,7 +334,14 @@ void remove_window(Window win) {
     
     if (current_window == node) {
         current_window = window_list;
+        status_invalidate();
+    }
+    if (drag.node == node) {
+        drag_end();
     }
+    syncreq_unmanage(node);
+    ping_unmanage(node);
+    switcher_forget(node);
     
     free(node);
     update_client_list();
@@ -179,28 +351,343 @@ void remove_window(Window win) {
 void focus_window(WindowNode *node) {
     if (!node) return;
     
-    // Check if window still exists
-    XWindowAttributes attrs;
-    if (XGetWindowAttributes(dpy, node->window, &attrs) == 0) {
-        return; // Window no longer exists
+    // Only the previously focused window needs its border reset; a client
+    // that vanished meanwhile just produces a non-fatal BadWindow
+    WindowNode *prev = current_window;
+    if (prev && prev != node) {
+        // Without compositing a window can only be captured while it is on
+        // top, so the switcher's preview is taken as it loses focus
+        if (!compositor_active() && is_visible(prev)) {
+            switcher_capture(prev);
+        }
+        frame_set_active(prev, 0);
     }
     
     current_window = node;
-    XRaiseWindow(dpy, node->window);
+    XRaiseWindow(dpy, node->frame);
     XSetInputFocus(dpy, node->window, RevertToPointerRoot, CurrentTime);
     update_active_window(node->window);
     
-    // Set window border to indicate focus
-    XSetWindowBorder(dpy, node->window, WhitePixel(dpy, screen));
+    // Set frame border and title bar to indicate focus; both are drawn, with
+    // the status bar's title, at the next frame
+    frame_set_active(node, 1);
+    status_invalidate();
+    
+    // Focus changes double as liveness checks
+    ping_send(node);
+    
+    // Never let a newly focused client cover the lock screen
+    lscreen_raise();
+}
+
+// Move/resize a frame, sending only the fields that differ from its cached
+// geometry; the client follows size changes below the title bar
+void configure_node(WindowNode *node, int x, int y, int width, int height) {
+    XWindowChanges changes;
+    unsigned int mask = 0;
+    
+    if (width < 1) width = 1;
+    if (height < TITLE_HEIGHT + 1) height = TITLE_HEIGHT + 1;
+    
+    // Clients using _NET_WM_SYNC_REQUEST get the next size only once they
+    // have drawn the previous one; the latest request waits in the node
+    if ((width != node->gwidth || height != node->gheight) && !syncreq_begin(node)) {
+        node->pending = 1;
+        node->px = x;
+        node->py = y;
+        node->pwidth = width;
+        node->pheight = height;
+        return;
+    }
+    node->pending = 0;
+    if (x != node->gx) { changes.x = node->gx = x; mask |= CWX; }
+    if (y != node->gy) { changes.y = node->gy = y; mask |= CWY; }
+    if (width != node->gwidth) { changes.width = node->gwidth = width; mask |= CWWidth; }
+    if (height != node->gheight) { changes.height = node->gheight = height; mask |= CWHeight; }
+    
+    if (mask) {
+        XConfigureWindow(dpy, node->frame, mask, &changes);
+    }
+    if (mask & (CWWidth | CWHeight)) {
+        XResizeWindow(dpy, node->window, node->gwidth, node->gheight - TITLE_HEIGHT);
+        frame_resize(node);
+    }
+}
+
+// A syncing client finished its last resize; send whatever was held back
+void sync_ready(WindowNode *node) {
+    if (node->pending) {
+        configure_node(node, node->px, node->py, node->pwidth, node->pheight);
+        XFlush(dpy);
+    }
+}
+
+// Tell a client where it is in root coordinates, as ICCCM asks of reparenting managers
+static void send_configure_notify(WindowNode *node) {
+    XConfigureEvent ce;
+    ce.type = ConfigureNotify;
+    ce.display = dpy;
+    ce.event = node->window;
+    ce.window = node->window;
+    ce.x = node->gx + settings_get()->border_width;
+    ce.y = node->gy + settings_get()->border_width + TITLE_HEIGHT;
+    ce.width = node->gwidth;
+    ce.height = node->gheight - TITLE_HEIGHT;
+    ce.border_width = 0;
+    ce.above = None;
+    ce.override_redirect = False;
+    XSendEvent(dpy, node->window, False, StructureNotifyMask, (XEvent *)&ce);
+}
+
+// Index of the monitor holding a window's center, the primary if none does
+static int node_monitor(WindowNode *node, Monitor *mons, int nmon) {
+    int cx = node->gx + node->gwidth / 2;
+    int cy = node->gy + node->gheight / 2;
+    for (int i = 0; i < nmon; i++) {
+        if (cx >= mons[i].x && cx < mons[i].x + mons[i].width &&
+            cy >= mons[i].y && cy < mons[i].y + mons[i].height) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// Tile the normal windows of each monitor; only windows whose tile changed
+// are reconfigured, and the whole relayout goes out in one flush
+void arrange() {
+    layout_dirty = 0;
+    if (layout == LAYOUT_FLOATING) return;
+    
+    Monitor mons[MAX_MONITORS];
+    int nmon = monitor_snapshot(mons, MAX_MONITORS);
+    int bw = settings_get()->border_width;
+    int owner[MAX_WINDOWS];
+    WindowNode *nodes[MAX_WINDOWS];
+    int count = 0;
+    
+    for (WindowNode *node = window_list; node && count < MAX_WINDOWS; node = node->next) {
+        if (node->state != WIN_NORMAL || node->desktop != current_desktop) continue;
+        owner[count] = node_monitor(node, mons, nmon);
+        nodes[count++] = node;
+    }
+    
+    for (int m = 0; m < nmon; m++) {
+        WindowNode *tiled[MAX_WINDOWS];
+        Tile tiles[MAX_WINDOWS];
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            if (owner[i] == m) tiled[n++] = nodes[i];
+        }
+        
+        // Leave room for the status bar along the bottom edge
+        Monitor area = mons[m];
+        area.height -= settings_get()->bar_height;
+        if (!layout_tile(layout, &area, n, tiles)) continue;
+        
+        for (int i = 0; i < n; i++) {
+            configure_node(tiled[i], tiles[i].x, tiles[i].y,
+                           tiles[i].width - 2 * bw, tiles[i].height - 2 * bw);
+        }
+    }
+    XFlush(dpy);
+}
+
+// Switch to the next layout; floating windows get their own geometry back
+void cycle_layout() {
+    layout_t next = (layout + 1) % LAYOUT_COUNT;
+    
+    for (WindowNode *node = window_list; node; node = node->next) {
+        if (node->state != WIN_NORMAL) continue;
+        if (layout == LAYOUT_FLOATING) {
+            // Remember the floating geometry before tiling over it
+            node->x = node->gx;
+            node->y = node->gy;
+            node->width = node->gwidth;
+            node->height = node->gheight;
+        } else if (next == LAYOUT_FLOATING) {
+            configure_node(node, node->x, node->y, node->width, node->height);
+        }
+    }
+    
+    layout = next;
+    arrange();
+}
+
+// Focus the first window shown on the current desktop, if any
+static void focus_first_visible() {
+    WindowNode *node = window_list;
+    while (node && !is_visible(node)) {
+        node = node->next;
+    }
+    if (node) {
+        focus_window(node);
+    } else {
+        current_window = NULL;
+        update_active_window(None);
+    }
+}
+
+// Hide a client by unmapping its frame; the client itself stays mapped, so
+// this never reaches handle_unmap_notify() as a withdrawal
+static void unmap_node(WindowNode *node) {
+    XUnmapWindow(dpy, node->frame);
+}
+
+// Show another desktop. The new set is mapped before the old one is unmapped,
+// all under a server grab, so nothing is repainted in between.
+void switch_desktop(int desktop) {
+    if (desktop < 0 || desktop >= NUM_DESKTOPS || desktop == current_desktop) return;
+    
+#ifdef TIMING
+    struct timespec start;
+    int switched = 0;
+    timer_start(&start);
+#endif
+    int old = current_desktop;
+    current_desktop = desktop;
+    
+    XGrabServer(dpy);
+    
+    // Tile the incoming windows first so they appear in place
+    arrange();
+    for (WindowNode *node = window_list; node; node = node->next) {
+        if (node->desktop == desktop && is_visible(node)) {
+            XMapWindow(dpy, node->frame);
+#ifdef TIMING
+            switched++;
+#endif
+        }
+    }
+    lscreen_raise();
+    for (WindowNode *node = window_list; node; node = node->next) {
+        if (node->desktop == old && node->state != WIN_HIDDEN && node->state != WIN_MINIMIZED) {
+            unmap_node(node);
+#ifdef TIMING
+            switched++;
+#endif
+        }
+    }
+    
+    long value = desktop;
+    XChangeProperty(dpy, root, net_current_desktop, XA_CARDINAL, 32,
+                   PropModeReplace, (unsigned char*)&value, 1);
+    
+    focus_first_visible();
+    
+    XUngrabServer(dpy);
+#ifdef TIMING
+    XSync(dpy, False);
+    fprintf(stderr, "desktop: switched %d -> %d (%d windows) in %ld us\n",
+            old, desktop, switched, timer_elapsed_us(&start));
+#else
+    XFlush(dpy);
+#endif
+}
+
+// Move the focused window to another desktop
+void send_to_desktop(int desktop) {
+    if (!current_window || desktop < 0 || desktop >= NUM_DESKTOPS ||
+        desktop == current_desktop) return;
+    
+    WindowNode *node = current_window;
+    node->desktop = desktop;
+    long value = desktop;
+    XChangeProperty(dpy, node->window, net_wm_desktop, XA_CARDINAL, 32,
+                   PropModeReplace, (unsigned char*)&value, 1);
     
-    // Remove focus from other windows
-    WindowNode *n = window_list;
-    while (n) {
-        if (n != node && XGetWindowAttributes(dpy, n->window, &attrs)) {
-            XSetWindowBorder(dpy, n->window, BlackPixel(dpy, screen));
+    if (node->state != WIN_HIDDEN && node->state != WIN_MINIMIZED) {
+        unmap_node(node);
+    }
+    layout_dirty = 1;
+    focus_first_visible();
+}
+
+// Begin moving or resizing a floating window with the pointer
+void drag_start(WindowNode *node, DragMode mode, XButtonEvent *e) {
+    if (drag.mode != DRAG_NONE || node->state != WIN_NORMAL || layout != LAYOUT_FLOATING) return;
+    
+    focus_window(node);
+    if (TRACE_X("XGrabPointer", XGrabPointer(dpy, root, False, ButtonReleaseMask | PointerMotionMask,
+                     GrabModeAsync, GrabModeAsync, None,
+                     mode == DRAG_MOVE ? move_cursor : resize_cursor, CurrentTime)) != GrabSuccess) {
+        return;
+    }
+    
+    drag.mode = mode;
+    drag.node = node;
+    drag.start_x = drag.px = e->x_root;
+    drag.start_y = drag.py = e->y_root;
+    drag.x = node->gx;
+    drag.y = node->gy;
+    drag.width = node->gwidth;
+    drag.height = node->gheight;
+    drag.pending = 0;
+    drag.timer = 0;
+    drag.last.tv_sec = drag.last.tv_nsec = 0;
+}
+
+// Send the geometry for the latest pointer position
+static void drag_apply() {
+    int dx = drag.px - drag.start_x;
+    int dy = drag.py - drag.start_y;
+    
+    drag.pending = 0;
+    if (drag.mode == DRAG_MOVE) {
+        configure_node(drag.node, drag.x + dx, drag.y + dy, drag.width, drag.height);
+    } else {
+        int width = drag.width + dx;
+        int height = drag.height + dy;
+        if (width < DRAG_MIN_SIZE) width = DRAG_MIN_SIZE;
+        if (height < TITLE_HEIGHT + DRAG_MIN_SIZE) height = TITLE_HEIGHT + DRAG_MIN_SIZE;
+        configure_node(drag.node, drag.x, drag.y, width, height);
+    }
+    XFlush(dpy);
+    timer_start(&drag.last);
+}
+
+static void drag_timer(void *arg) {
+    drag.timer = 0;
+    if (drag.mode != DRAG_NONE && drag.pending) {
+        drag_apply();
+    }
+}
+
+// Follow the pointer, sending at most one configure per display refresh
+void drag_motion(XMotionEvent *e) {
+    if (drag.mode == DRAG_NONE) return;
+    
+    drag.px = e->x_root;
+    drag.py = e->y_root;
+    drag.pending = 1;
+    
+    long interval = 1000000L / monitor_refresh_rate();
+    long elapsed = timer_elapsed_us(&drag.last);
+    if (elapsed >= interval) {
+        if (drag.timer) {
+            evloop_cancel_timer(drag.timer);
+            drag.timer = 0;
         }
-        n = n->next;
+        drag_apply();
+    } else if (!drag.timer) {
+        drag.timer = evloop_add_timer(interval - elapsed, drag_timer, NULL);
+    }
+}
+
+// Finish the drag at the last pointer position
+void drag_end() {
+    if (drag.mode == DRAG_NONE) return;
+    
+    if (drag.timer) {
+        evloop_cancel_timer(drag.timer);
+        drag.timer = 0;
     }
+    if (drag.pending) {
+        drag_apply();
+    }
+    XUngrabPointer(dpy, CurrentTime);
+    send_configure_notify(drag.node);
+    drag.mode = DRAG_NONE;
+    drag.node = NULL;
 }
 
 // Alt+Tab functionality
@@ -208,7 +695,7 @@ void next_window() {
     if (!current_window || !window_list) {
         // If no current window, focus first available window
         WindowNode *node = window_list;
-        while (node && (node->state == WIN_HIDDEN || node->state == WIN_MINIMIZED)) {
+        while (node && !is_visible(node)) {
             node = node->next;
         }
         if (node) {
@@ -224,26 +711,66 @@ void next_window() {
     
     // Skip hidden/minimized windows
     WindowNode *start = next;
-    while (next && (next->state == WIN_HIDDEN || next->state == WIN_MINIMIZED)) {
+    while (next && !is_visible(next)) {
         next = next->next;
         if (!next) next = window_list;
         if (next == start) break; // Avoid infinite loop
     }
     
     if (next && next != current_window && 
-        next->state != WIN_HIDDEN && next->state != WIN_MINIMIZED) {
+        is_visible(next)) {
         focus_window(next);
     }
 }
 
+// Alt+Tab: open the thumbnail switcher on the window after the focused one
+void show_switcher(unsigned int mods) {
+    WindowNode *nodes[MAX_WINDOWS];
+    int n = 0, selected = 0;
+    
+    for (WindowNode *node = window_list; node && n < MAX_WINDOWS; node = node->next) {
+        if (!is_visible(node)) continue;
+        if (node == current_window) selected = n + 1;
+        nodes[n++] = node;
+    }
+    if (selected >= n) selected = 0;
+    
+    // Without compositing, thumbnails otherwise only come from focus changes:
+    // the focused window is on top and fresh now, and a window that never lost
+    // focus gets a best-effort capture rather than an empty cell
+    if (!compositor_active()) {
+        for (int i = 0; i < n; i++) {
+            if (nodes[i] == current_window || !nodes[i]->thumb) switcher_capture(nodes[i]);
+        }
+    }
+    
+    // Nothing to choose between, or the keyboard is grabbed elsewhere
+    if (n < 2 || !switcher_show(nodes, n, selected, mods)) {
+        next_window();
+    }
+}
+
+// Compositor damage on a frame dirties that window's thumbnail
+void window_damaged(Window frame) {
+    WindowNode *node = find_frame(frame);
+    if (node) switcher_invalidate(node);
+}
+
 // Close current window
 void close_window() {
     if (!current_window) return;
     
+    // Closing a window that already ignored a close and the ping after it kills it;
+    // a miss on a ping from a focus change only marks it as not responding
+    if (current_window->close_hung) {
+        XKillClient(dpy, current_window->window);
+        return;
+    }
+    
     // Try to close gracefully first
     Atom *protocols;
     int n;
-    if (XGetWMProtocols(dpy, current_window->window, &protocols, &n)) {
+    if (TRACE_X("XGetWMProtocols", XGetWMProtocols(dpy, current_window->window, &protocols, &n))) {
         for (int i = 0; i < n; i++) {
             if (protocols[i] == wm_delete_window) {
                 XEvent e;
@@ -255,6 +782,8 @@ void close_window() {
                 e.xclient.data.l[1] = CurrentTime;
                 XSendEvent(dpy, current_window->window, False, NoEventMask, &e);
                 XFree(protocols);
+                // A client that does not answer is killed on the next close
+                ping_close(current_window);
                 return;
             }
         }
@@ -275,7 +804,8 @@ void minimize_window() {
     }
     
     current_window->state = WIN_MINIMIZED;
-    XUnmapWindow(dpy, current_window->window);
+    unmap_node(current_window);
+    layout_dirty = 1;
     
     // Set EWMH state
     Atom state = net_wm_state_hidden;
@@ -289,14 +819,14 @@ void minimize_window() {
     WindowNode *next = minimized->next;
     if (!next) next = window_list;
     
-    while (next && (next->state == WIN_HIDDEN || next->state == WIN_MINIMIZED)) {
+    while (next && !is_visible(next)) {
         next = next->next;
         if (!next) next = window_list;
         if (next == minimized) break;
     }
     
     if (next && next != minimized && 
-        next->state != WIN_HIDDEN && next->state != WIN_MINIMIZED) {
+        is_visible(next)) {
         focus_window(next);
     } else {
         update_active_window(None);
@@ -312,7 +842,16 @@ void restore_window() {
     
     if (node && node->state == WIN_MINIMIZED) {
         node->state = WIN_NORMAL;
-        XMapWindow(dpy, node->window);
+        if (node->desktop != current_desktop) {
+            // Restored windows come to the desktop being looked at
+            node->desktop = current_desktop;
+            long desktop = current_desktop;
+            XChangeProperty(dpy, node->window, net_wm_desktop, XA_CARDINAL, 32,
+                           PropModeReplace, (unsigned char*)&desktop, 1);
+        }
+        arrange();
+        XMapWindow(dpy, node->frame);
+        lscreen_raise();
         
         // Remove EWMH state
         XDeleteProperty(dpy, node->window, net_wm_state);
@@ -321,42 +860,46 @@ void restore_window() {
     }
 }
 
-// Maximize current window
-void maximize_window() {
-    if (!current_window) return;
-    
-    if (current_window->state == WIN_MAXIMIZED) {
-        // Restore
-        current_window->state = WIN_NORMAL;
-        XMoveResizeWindow(dpy, current_window->window,
-                         current_window->x, current_window->y,
-                         current_window->width, current_window->height);
+// Maximize a window onto its monitor, or put it back
+void set_maximized(WindowNode *node, int on) {
+    if (!on) {
+        // Restore; a tiled window goes back into the layout instead
+        node->state = WIN_NORMAL;
+        configure_node(node, node->x, node->y,
+                       node->width, node->height);
+        layout_dirty = 1;
         
         // Remove EWMH state
-        XDeleteProperty(dpy, current_window->window, net_wm_state);
+        XDeleteProperty(dpy, node->window, net_wm_state);
     } else {
         // Save current geometry
-        XWindowAttributes attrs;
-        XGetWindowAttributes(dpy, current_window->window, &attrs);
-        current_window->x = attrs.x;
-        current_window->y = attrs.y;
-        current_window->width = attrs.width;
-        current_window->height = attrs.height;
+        node->x = node->gx;
+        node->y = node->gy;
+        node->width = node->gwidth;
+        node->height = node->gheight;
         
-        // Maximize
-        current_window->state = WIN_MAXIMIZED;
-        int screen_width = DisplayWidth(dpy, screen);
-        int screen_height = DisplayHeight(dpy, screen);
-        XMoveResizeWindow(dpy, current_window->window, 0, 0,
-                         screen_width, screen_height);
+        // Maximize onto the monitor holding the window's center, above the status bar
+        node->state = WIN_MAXIMIZED;
+        Monitor mon = monitor_at(node->gx + node->gwidth / 2,
+                                 node->gy + node->gheight / 2);
+        configure_node(node, mon.x, mon.y,
+                       mon.width - 2 * settings_get()->border_width,
+                       mon.height - settings_get()->bar_height - 2 * settings_get()->border_width);
+        layout_dirty = 1;
         
         // Set EWMH state
         Atom states[] = {net_wm_state_maximized_vert, net_wm_state_maximized_horz};
-        XChangeProperty(dpy, current_window->window, net_wm_state, XA_ATOM, 32,
+        XChangeProperty(dpy, node->window, net_wm_state, XA_ATOM, 32,
                        PropModeReplace, (unsigned char*)states, 2);
     }
 }
 
+// Maximize current window
+void maximize_window() {
+    if (!current_window) return;
+    set_maximized(current_window, current_window->state != WIN_MAXIMIZED);
+}
+
 // Hide current window
 void hide_window() {
     if (!current_window || current_window->state == WIN_HIDDEN || hidden_count >= MAX_HIDDEN) return;
@@ -367,7 +910,8 @@ void hide_window() {
     }
     
     current_window->state = WIN_HIDDEN;
-    XUnmapWindow(dpy, current_window->window);
+    unmap_node(current_window);
+    layout_dirty = 1;
     
     // Set EWMH state
     Atom state = net_wm_state_hidden;
@@ -381,14 +925,14 @@ void hide_window() {
     WindowNode *next = hidden->next;
     if (!next) next = window_list;
     
-    while (next && (next->state == WIN_HIDDEN || next->state == WIN_MINIMIZED)) {
+    while (next && !is_visible(next)) {
         next = next->next;
         if (!next) next = window_list;
         if (next == hidden) break;
     }
     
     if (next && next != hidden && 
-        next->state != WIN_HIDDEN && next->state != WIN_MINIMIZED) {
+        is_visible(next)) {
         focus_window(next);
     } else {
         update_active_window(None);
@@ -404,7 +948,16 @@ void unhide_last_window() {
     
     if (node && node->state == WIN_HIDDEN) {
         node->state = WIN_NORMAL;
-        XMapWindow(dpy, node->window);
+        if (node->desktop != current_desktop) {
+            // Restored windows come to the desktop being looked at
+            node->desktop = current_desktop;
+            long desktop = current_desktop;
+            XChangeProperty(dpy, node->window, net_wm_desktop, XA_CARDINAL, 32,
+                           PropModeReplace, (unsigned char*)&desktop, 1);
+        }
+        arrange();
+        XMapWindow(dpy, node->frame);
+        lscreen_raise();
         
         // Remove EWMH state
         XDeleteProperty(dpy, node->window, net_wm_state);
@@ -413,79 +966,222 @@ void unhide_last_window() {
     }
 }
 
-// Handle key press events
-void handle_keypress(XKeyEvent *e) {
-    KeySym key = XLookupKeysym(e, 0);
-    
-    // Alt+Tab
-    if ((e->state & Mod1Mask) && key == XK_Tab) {
-        next_window();
+// Index of the Shift/Control/Alt/Super combination in a keymap row
+static int mod_index(unsigned int state) {
+    return ((state & ShiftMask) ? 1 : 0) | ((state & ControlMask) ? 2 : 0) |
+           ((state & Mod1Mask) ? 4 : 0) | ((state & Mod4Mask) ? 8 : 0);
+}
+
+// Actions a config file binding can name
+static const struct {
+    const char *name;
+    void (*func)(const Arg *arg);
+    void (*fn)(void);
+} actions[] = {
+    { "switcher", key_switcher, NULL },
+    { "close", key_call, close_window },
+    { "quit", key_quit, NULL },
+    { "restart", key_restart, NULL },
+    { "run", key_call, rundlg_show },
+    { "minimize", key_call, minimize_window },
+    { "lock", key_call, lscreen_show },
+    { "maximize", key_call, maximize_window },
+    { "restore", key_call, restore_window },
+    { "hide", key_call, hide_window },
+    { "unhide", key_call, unhide_last_window },
+    { "layout", key_call, cycle_layout },
+    { "desktop", key_desktop, NULL },
+    { "send", key_send, NULL },
+};
+
+// Turn a config file binding into a Key; 0 if it names no known action
+static int resolve_binding(const Binding *b, Key *key) {
+    for (size_t i = 0; i < sizeof(actions) / sizeof(actions[0]); i++) {
+        if (strcmp(actions[i].name, b->action)) continue;
+        key->mod = b->mod;
+        key->keysym = b->keysym;
+        key->func = actions[i].func;
+        if (actions[i].fn) {
+            key->arg.fn = actions[i].fn;
+        } else {
+            key->arg.i = b->arg;
+        }
+        return 1;
     }
-    // Alt+F4 (close window)
-    else if ((e->state & Mod1Mask) && key == XK_F4) {
-        close_window();
+    return 0;
+}
+
+// Derive the dispatch table and passive grabs from the binding table. Each
+// binding, and the Super+drag buttons, is grabbed four times so CapsLock and
+// NumLock do not defeat it.
+void grab_keys() {
+    unsigned int numlock_mask = 0;
+    KeyCode numlock = XKeysymToKeycode(dpy, XK_Num_Lock);
+    XModifierKeymap *modmap = XGetModifierMapping(dpy);
+    for (int i = 0; i < 8 * modmap->max_keypermod; i++) {
+        if (numlock && modmap->modifiermap[i] == numlock) {
+            numlock_mask = 1 << (i / modmap->max_keypermod);
+        }
     }
-    // Super+Q (quit window manager)
-    else if ((e->state & Mod4Mask) && key == XK_q) {
-        running = 0;
+    XFreeModifiermap(modmap);
+    unsigned int locks[] = { 0, LockMask, numlock_mask, numlock_mask | LockMask };
+    
+    // Bindings from the config file come last and win over config.h
+    int nkeys = 0;
+    const Settings *cfg = settings_get();
+    for (int b = 0; b < cfg->nbindings; b++) {
+        if (resolve_binding(&cfg->bindings[b], &config_keys[nkeys])) {
+            nkeys++;
+        } else {
+            fprintf(stderr, "swm: unknown action '%s'\n", cfg->bindings[b].action);
+        }
     }
-    // Super+D (run dialog)
-    else if ((e->state & Mod4Mask) && key == XK_d) {
-        if (rundlg_init(dpy, screen)) {
-            rundlg_show();
-            rundlg_free();
+    
+    memset(keymap, 0, sizeof(keymap));
+    XUngrabKey(dpy, AnyKey, AnyModifier, root);
+    for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]) + nkeys; k++) {
+        const Key *key = k < sizeof(keys) / sizeof(keys[0]) ? &keys[k] : &config_keys[k - sizeof(keys) / sizeof(keys[0])];
+        KeyCode code = XKeysymToKeycode(dpy, key->keysym);
+        if (!code) continue;
+        keymap[code][mod_index(key->mod)] = key;
+        for (int l = 0; l < 4; l++) {
+            XGrabKey(dpy, code, key->mod | locks[l], root, True,
+                     GrabModeAsync, GrabModeAsync);
         }
     }
-    // Super+N (minimize)
-    else if ((e->state & Mod4Mask) && key == XK_n) {
-        minimize_window();
+    
+    // Super+drag moves and resizes windows
+    XUngrabButton(dpy, AnyButton, AnyModifier, root);
+    for (int l = 0; l < 4; l++) {
+        XGrabButton(dpy, Button1, Mod4Mask | locks[l], root, True, ButtonPressMask | ButtonReleaseMask |
+                    PointerMotionMask, GrabModeAsync, GrabModeAsync, None, None);
+        XGrabButton(dpy, Button3, Mod4Mask | locks[l], root, True, ButtonPressMask | ButtonReleaseMask |
+                    PointerMotionMask, GrabModeAsync, GrabModeAsync, None, None);
+    }
+}
+
+// Handle key press events
+void handle_keypress(XKeyEvent *e) {
+    const Key *key = keymap[e->keycode][mod_index(e->state)];
+    if (key) {
+        key_active = key;
+        AUDIT_BEGIN_KEY(key->mod, key->keysym);
+        key->func(&key->arg);
+        AUDIT_END();
+    }
+}
+
+// Binding actions
+void key_call(const Arg *arg) {
+    arg->fn();
+}
+
+// The switcher stays open while the binding's modifiers are held
+void key_switcher(const Arg *arg) {
+    show_switcher(key_active->mod);
+}
+
+void key_quit(const Arg *arg) {
+    running = 0;
+}
+
+// Leave the main loop, hand the window state over and exec a fresh swm
+void key_restart(const Arg *arg) {
+    restarting = 1;
+    running = 0;
+}
+
+void key_desktop(const Arg *arg) {
+    switch_desktop(arg->i);
+}
+
+// Move the focused window to a desktop
+void key_send(const Arg *arg) {
+    send_to_desktop(arg->i);
+}
+
+// A config reload: touch only the borders, bar and grabs that changed
+void apply_settings(const Settings *old, const Settings *cur, int changed) {
+    if (changed & (SETTINGS_BORDER | SETTINGS_FONT)) {
+        frame_apply_settings(cur);
+        for (WindowNode *node = window_list; node; node = node->next) {
+            frame_refresh(node);
+        }
     }
-    // Super+L (lock screen)
-    else if ((e->state & Mod4Mask) && key == XK_l) {
-        if (lscreen_init(dpy, screen)) {
-            lscreen_show();
-            lscreen_free();
+    
+    // Client positions and tiles depend on the border and bar sizes
+    if (old->border_width != cur->border_width) {
+        for (WindowNode *node = window_list; node; node = node->next) {
+            send_configure_notify(node);
         }
     }
-    // Super+M (maximize)
-    else if ((e->state & Mod4Mask) && key == XK_m) {
-        maximize_window();
+    if (old->border_width != cur->border_width || old->bar_height != cur->bar_height) {
+        layout_dirty = 1;
+    }
+    
+    if (changed & SETTINGS_KEYS) {
+        grab_keys();
+    }
+    if (changed & SETTINGS_RULES) {
+        rules_compile(cur);
     }
-    // Super+R (restore)
-    else if ((e->state & Mod4Mask) && key == XK_r) {
-        restore_window();
+    if (changed & SETTINGS_BAR) {
+        status_invalidate();
     }
-    // Super+X (hide)
-    else if ((e->state & Mod4Mask) && key == XK_x) {
-        hide_window();
+    // SETTINGS_LOCK needs nothing here: the lock screen reads it when shown
+}
+
+// Window rules decide a new window's desktop and state before it is first mapped
+static void apply_rules(WindowNode *node, RuleAction *rule) {
+    if (!rules_match(node->window, rule)) return;
+    
+    if (rule->desktop >= 0 && rule->desktop != node->desktop) {
+        node->desktop = rule->desktop;
+        long desktop = node->desktop;
+        XChangeProperty(dpy, node->window, net_wm_desktop, XA_CARDINAL, 32,
+                       PropModeReplace, (unsigned char*)&desktop, 1);
     }
-    // Super+Z (unhide last)
-    else if ((e->state & Mod4Mask) && key == XK_z) {
-        unhide_last_window();
+    if (rule->maximized == 1) {
+        set_maximized(node, 1);
     }
 }
 
 // Handle map request
 void handle_map_request(XMapRequestEvent *e) {
     WindowNode *node = find_window(e->window);
+    RuleAction rule = { -1, -1, -1 };
     if (!node) {
         node = add_window(e->window);
+        if (node) apply_rules(node, &rule);
     }
     
     if (node) {
+        // Place the new window in the layout before it first appears
+        if (node->state == WIN_NORMAL) {
+            arrange();
+        }
         XMapWindow(dpy, e->window);
-        focus_window(node);
-        
-        // Add window border
-        XSetWindowBorderWidth(dpy, e->window, 2);
-        XSetWindowBorder(dpy, e->window, WhitePixel(dpy, screen));
+        if (is_visible(node)) {
+            XMapWindow(dpy, node->frame);
+            // Frames mapped under an active lock must not cover it
+            lscreen_raise();
+            if (rule.nofocus != 1) focus_window(node);
+        }
     }
 }
 
 // Handle unmap notify
 void handle_unmap_notify(XUnmapEvent *e) {
     WindowNode *node = find_window(e->window);
-    if (node && node->state != WIN_MINIMIZED && node->state != WIN_HIDDEN) {
+    
+    // The unmap caused by reparenting a mapped client into its frame is not a withdrawal
+    if (node && node->ignore_unmap > 0 && !e->send_event) {
+        node->ignore_unmap--;
+        return;
+    }
+    
+    // swm hides windows by unmapping their frames, so any client unmap is a withdrawal
+    if (node) {
         // Remove from hidden windows array if present
         for (int i = 0; i < hidden_count; i++) {
             if (hidden_windows[i] == e->window) {
@@ -498,7 +1194,9 @@ void handle_unmap_notify(XUnmapEvent *e) {
             }
         }
         
+        frame_destroy(node, 1);
         remove_window(e->window);
+        layout_dirty = 1;
         
         // Focus next window if this was current
         if (current_window == node) {
@@ -506,7 +1204,7 @@ void handle_unmap_notify(XUnmapEvent *e) {
             if (window_list) {
                 // Find first visible window
                 WindowNode *next = window_list;
-                while (next && (next->state == WIN_HIDDEN || next->state == WIN_MINIMIZED)) {
+                while (next && !is_visible(next)) {
                     next = next->next;
                 }
                 if (next) {
@@ -542,12 +1240,14 @@ void handle_destroy_notify(XDestroyWindowEvent *e) {
             current_window = NULL;
         }
         
+        frame_destroy(node, 0);
         remove_window(e->window);
+        layout_dirty = 1;
         
         // Focus next available window
         if (window_list) {
             WindowNode *next = window_list;
-            while (next && (next->state == WIN_HIDDEN || next->state == WIN_MINIMIZED)) {
+            while (next && !is_visible(next)) {
                 next = next->next;
             }
             if (next) {
@@ -561,8 +1261,150 @@ void handle_destroy_notify(XDestroyWindowEvent *e) {
     }
 }
 
+// Super+Button1 moves, Super+Button3 resizes; a plain click on a title bar
+// focuses and moves
+void handle_button_press(XButtonEvent *e) {
+    WindowNode *node = e->window == root ? find_frame(e->subwindow) : find_frame(e->window);
+    if (!node) return;
+    
+    // Plain clicks in the client area only focus; moves need the title bar or Super
+    if (e->button == Button1 && ((e->state & Mod4Mask) || e->y < TITLE_HEIGHT)) {
+        drag_start(node, DRAG_MOVE, e);
+    } else if (e->button == Button3 && (e->state & Mod4Mask)) {
+        drag_start(node, DRAG_RESIZE, e);
+    }
+    if (drag.mode == DRAG_NONE) {
+        focus_window(node);
+    }
+}
+
+// Cache WM_NORMAL_HINTS so requests can be checked without a round trip
+void update_size_hints(WindowNode *node) {
+    XSizeHints hints;
+    long supplied;
+    
+    node->min_w = node->min_h = node->max_w = node->max_h = 0;
+    node->inc_w = node->inc_h = node->base_w = node->base_h = 0;
+    if (!TRACE_X("XGetWMNormalHints", XGetWMNormalHints(dpy, node->window, &hints, &supplied))) return;
+    
+    if (hints.flags & PMinSize) {
+        node->min_w = hints.min_width;
+        node->min_h = hints.min_height;
+    }
+    if (hints.flags & PMaxSize) {
+        node->max_w = hints.max_width;
+        node->max_h = hints.max_height;
+    }
+    if (hints.flags & PResizeInc) {
+        node->inc_w = hints.width_inc;
+        node->inc_h = hints.height_inc;
+    }
+    if (hints.flags & PBaseSize) {
+        node->base_w = hints.base_width;
+        node->base_h = hints.base_height;
+    } else if (hints.flags & PMinSize) {
+        // ICCCM: the minimum size stands in for a missing base size
+        node->base_w = node->min_w;
+        node->base_h = node->min_h;
+    }
+}
+
+// Clamp a client size to its hints: whole increments above the base, within min and max
+static void apply_size_hints(WindowNode *node, int *width, int *height) {
+    if (node->inc_w > 0) *width -= (*width - node->base_w) % node->inc_w;
+    if (node->inc_h > 0) *height -= (*height - node->base_h) % node->inc_h;
+    if (node->min_w > 0 && *width < node->min_w) *width = node->min_w;
+    if (node->min_h > 0 && *height < node->min_h) *height = node->min_h;
+    if (node->max_w > 0 && *width > node->max_w) *width = node->max_w;
+    if (node->max_h > 0 && *height > node->max_h) *height = node->max_h;
+}
+
+// Restack a frame as its client asked; a sibling must be another managed client
+static void restack_node(WindowNode *node, XConfigureRequestEvent *e) {
+    XWindowChanges changes;
+    unsigned int mask = CWStackMode;
+    
+    changes.stack_mode = e->detail;
+    if (e->value_mask & CWSibling) {
+        WindowNode *sibling = find_window(e->above);
+        if (!sibling || sibling == node) return;
+        changes.sibling = sibling->frame;
+        mask |= CWSibling;
+    }
+    XConfigureWindow(dpy, node->frame, mask, &changes);
+    
+    // Never let a client restack itself above the lock screen
+    lscreen_raise();
+}
+
 // Handle configure request
 void handle_configure_request(XConfigureRequestEvent *e) {
+    WindowNode *node = find_window(e->window);
+    
+    // Managed clients are moved through their frame; tiled ones keep their tile.
+    // Either way the client learns where it actually is.
+    if (node) {
+        // Fold requests from the same client queued right behind this one,
+        // so a startup storm costs one configure and one notify. Anything
+        // else in between ends the run, keeping events in order.
+        XEvent next;
+        while (XEventsQueued(dpy, QueuedAlready) > 0) {
+            XPeekEvent(dpy, &next);
+            if (next.type != ConfigureRequest || next.xconfigurerequest.window != e->window) break;
+            XNextEvent(dpy, &next);
+            XConfigureRequestEvent *n = &next.xconfigurerequest;
+            if (n->value_mask & CWX) e->x = n->x;
+            if (n->value_mask & CWY) e->y = n->y;
+            if (n->value_mask & CWWidth) e->width = n->width;
+            if (n->value_mask & CWHeight) e->height = n->height;
+            if (n->value_mask & CWSibling) e->above = n->above;
+            if (n->value_mask & CWStackMode) e->detail = n->detail;
+            e->value_mask |= n->value_mask;
+#ifdef TIMING
+            configure_coalesced++;
+#endif
+        }
+#ifdef TIMING
+        configure_requests++;
+#endif
+        
+        if (e->value_mask & CWStackMode) {
+            restack_node(node, e);
+        }
+        
+        if (node->state == WIN_MAXIMIZED || (node->state == WIN_NORMAL && layout != LAYOUT_FLOATING)) {
+#ifdef TIMING
+            configure_refused++;
+#endif
+            send_configure_notify(node);
+            return;
+        }
+        
+        // Requests give the client's position; the frame sits around it, as
+        // send_configure_notify() reports
+        int bw = settings_get()->border_width;
+        int x = (e->value_mask & CWX) ? e->x - bw : node->gx;
+        int y = (e->value_mask & CWY) ? e->y - bw - TITLE_HEIGHT : node->gy;
+        int width = (e->value_mask & CWWidth) ? e->width : node->gwidth;
+        int height = (e->value_mask & CWHeight) ? e->height : node->gheight - TITLE_HEIGHT;
+        apply_size_hints(node, &width, &height);
+        height += TITLE_HEIGHT;
+        
+        // Compare with where the window is headed, which may be a held-back resize
+        int same = node->pending ?
+            x == node->px && y == node->py && width == node->pwidth && height == node->pheight :
+            x == node->gx && y == node->gy && width == node->gwidth && height == node->gheight;
+        if (!same) {
+            configure_node(node, x, y, width, height);
+        }
+#ifdef TIMING
+        if (same) configure_noop++;
+        else configure_applied++;
+#endif
+        send_configure_notify(node);
+        return;
+    }
+    
     XWindowChanges changes;
     changes.x = e->x;
     changes.y = e->y;
@@ -575,26 +1417,343 @@ void handle_configure_request(XConfigureRequestEvent *e) {
     XConfigureWindow(dpy, e->window, e->value_mask, &changes);
 }
 
+// Store every window's state on the root window for the next swm process.
+// Clients not on screen are unmapped first so they do not show up undecorated
+// while no window manager is running.
+void save_state() {
+    long *blob = malloc(RESTART_MAX_LONGS * sizeof(long));
+    if (!blob) return;
+    
+    long *p = blob + RESTART_HEADER;
+    int count = 0;
+    for (WindowNode *node = window_list; node && count < MAX_WINDOWS; node = node->next, count++) {
+        *p++ = node->window;
+        *p++ = node->state;
+        *p++ = node->desktop;
+        *p++ = node->x;
+        *p++ = node->y;
+        *p++ = node->width;
+        *p++ = node->height;
+        *p++ = node->gx;
+        *p++ = node->gy;
+        *p++ = node->gwidth;
+        *p++ = node->gheight;
+        if (!is_visible(node)) {
+            XUnmapWindow(dpy, node->window);
+        }
+    }
+    for (int i = 0; i < minimized_count; i++) *p++ = minimized_windows[i];
+    for (int i = 0; i < hidden_count; i++) *p++ = hidden_windows[i];
+    
+    blob[0] = RESTART_MAGIC;
+    blob[1] = RESTART_VERSION;
+    blob[2] = current_desktop;
+    blob[3] = layout;
+    blob[4] = current_window ? current_window->window : None;
+    blob[5] = count;
+    blob[6] = minimized_count;
+    blob[7] = hidden_count;
+    XChangeProperty(dpy, root, swm_restart_state, XA_CARDINAL, 32,
+                   PropModeReplace, (unsigned char*)blob, p - blob);
+    free(blob);
+}
+
+// Manage a window recorded by the previous process with its old state
+static void adopt_record(const long *rec) {
+    XWindowAttributes attrs;
+    Window win = rec[0];
+    
+    // Skip clients that went away during the restart
+    if (find_window(win) || !XGetWindowAttributes(dpy, win, &attrs) || attrs.override_redirect) {
+        return;
+    }
+    WindowNode *node = add_window(win);
+    if (!node) return;
+    
+    node->state = rec[1] >= WIN_NORMAL && rec[1] <= WIN_HIDDEN ? (WindowState)rec[1] : WIN_NORMAL;
+    node->desktop = rec[2] >= 0 && rec[2] < NUM_DESKTOPS ? rec[2] : current_desktop;
+    node->x = rec[3];
+    node->y = rec[4];
+    node->width = rec[5];
+    node->height = rec[6];
+    configure_node(node, rec[7], rec[8], rec[9], rec[10]);
+    
+    long desktop = node->desktop;
+    XChangeProperty(dpy, win, net_wm_desktop, XA_CARDINAL, 32,
+                   PropModeReplace, (unsigned char*)&desktop, 1);
+    XMapWindow(dpy, win);
+    if (is_visible(node)) {
+        XMapWindow(dpy, node->frame);
+        lscreen_raise();
+    }
+}
+
+// Take over the windows already on screen at startup. After a restart the
+// previous process left their state on the root window; everything else
+// mapped is managed like a new window.
+void adopt_windows() {
+    Atom type;
+    int format;
+    unsigned long n = 0, after;
+    unsigned char *data = NULL;
+    long *blob = NULL;
+#ifdef TIMING
+    struct timespec start;
+    timer_start(&start);
+#endif
+    
+    if (XGetWindowProperty(dpy, root, swm_restart_state, 0, RESTART_MAX_LONGS, True,
+                           XA_CARDINAL, &type, &format, &n, &after, &data) == Success && data) {
+        blob = (long *)data;
+        if (format != 32 || n < RESTART_HEADER || blob[0] != RESTART_MAGIC || blob[1] != RESTART_VERSION ||
+            blob[5] < 0 || blob[5] > MAX_WINDOWS || blob[6] < 0 || blob[6] > MAX_MINIMIZED ||
+            blob[7] < 0 || blob[7] > MAX_HIDDEN ||
+            n != (unsigned long)(RESTART_HEADER + blob[5] * RESTART_RECORD + blob[6] + blob[7])) {
+            fprintf(stderr, "swm: ignoring unusable restart state\n");
+            blob = NULL;
+        }
+    }
+    
+    XGrabServer(dpy);
+    int count = 0;
+    if (blob) {
+        count = blob[5];
+        if (blob[2] >= 0 && blob[2] < NUM_DESKTOPS) current_desktop = blob[2];
+        if (blob[3] >= 0 && blob[3] < LAYOUT_COUNT) layout = blob[3];
+        
+        // Nodes are prepended, so adopting in reverse rebuilds the old order
+        for (int i = count - 1; i >= 0; i--) {
+            adopt_record(blob + RESTART_HEADER + i * RESTART_RECORD);
+        }
+        
+        // The LIFO stacks, minus windows that did not survive
+        const long *stack = blob + RESTART_HEADER + count * RESTART_RECORD;
+        for (int i = 0; i < blob[6]; i++) {
+            WindowNode *node = find_window(stack[i]);
+            if (node && node->state == WIN_MINIMIZED) minimized_windows[minimized_count++] = node->window;
+        }
+        stack += blob[6];
+        for (int i = 0; i < blob[7]; i++) {
+            WindowNode *node = find_window(stack[i]);
+            if (node && node->state == WIN_HIDDEN) hidden_windows[hidden_count++] = node->window;
+        }
+    }
+    
+    // Mapped windows the previous process did not know about
+    Window root_return, parent_return, *children = NULL;
+    unsigned int nchildren = 0;
+    if (XQueryTree(dpy, root, &root_return, &parent_return, &children, &nchildren)) {
+        for (unsigned int i = 0; i < nchildren; i++) {
+            XWindowAttributes attrs;
+            if (find_window(children[i]) || find_frame(children[i]) ||
+                !XGetWindowAttributes(dpy, children[i], &attrs) ||
+                attrs.override_redirect || attrs.map_state != IsViewable) {
+                continue;
+            }
+            WindowNode *node = add_window(children[i]);
+            if (node) XMapWindow(dpy, node->frame);
+        }
+        if (children) XFree(children);
+        lscreen_raise();
+    }
+    
+    long desktop = current_desktop;
+    XChangeProperty(dpy, root, net_current_desktop, XA_CARDINAL, 32,
+                   PropModeReplace, (unsigned char*)&desktop, 1);
+    layout_dirty = 1;
+    XUngrabServer(dpy);
+    
+    // Focus what was focused before, if it is still on screen
+    WindowNode *focus = blob ? find_window(blob[4]) : NULL;
+    if (focus && is_visible(focus)) {
+        focus_window(focus);
+    } else {
+        focus_first_visible();
+    }
+    if (data) XFree(data);
+    
+#ifdef TIMING
+    int managed = 0;
+    for (WindowNode *node = window_list; node; node = node->next) managed++;
+    fprintf(stderr, "adopted %d windows (%d recorded) in %ld us\n",
+            managed, count, timer_elapsed_us(&start));
+#endif
+}
+
 // Cleanup function
 void cleanup() {
     WindowNode *node = window_list;
     while (node) {
         WindowNode *next = node->next;
+        // Hand clients back to the root window so they survive swm exiting
+        if (dpy) {
+            syncreq_unmanage(node);
+            ping_unmanage(node);
+            switcher_forget(node);
+            frame_destroy(node, 1);
+        }
         free(node);
         node = next;
     }
+    window_list = NULL;
+    switcher_free();
+    compositor_free();
+    frame_free();
+    if (dpy && move_cursor) XFreeCursor(dpy, move_cursor);
+    if (dpy && resize_cursor) XFreeCursor(dpy, resize_cursor);
     
     status_free();
+    redraw_free();
+    rundlg_free();
+    rules_free();
+    lscreen_free();
+    settings_free();
+
+    trace_write();
+    audit_report();
+
+#ifdef TIMING
+    report_event_latency();
+    fprintf(stderr, "configure requests %ld: applied %ld, no-op %ld, refused %ld, coalesced %ld more\n",
+            configure_requests, configure_applied, configure_noop, configure_refused,
+            configure_coalesced);
+#endif
 
     if (dpy) {
         XCloseDisplay(dpy);
     }
 }
 
-// Signal handler
+#ifdef TIMING
+// Print one line per event type: count, mean and worst handling time in microseconds
+void report_event_latency() {
+    fprintf(stderr, "%-18s %8s %10s %10s\n", "event", "count", "avg_us", "max_us");
+    for (int i = 0; i < LASTEvent; i++) {
+        if (!event_count[i]) continue;
+        char number[16];
+        const char *name = event_names[i];
+        if (!name) {
+            snprintf(number, sizeof(number), "event%d", i);
+            name = number;
+        }
+        fprintf(stderr, "%-18s %8ld %10.2f %10.2f\n", name, event_count[i],
+                event_total_ns[i] / 1000.0 / event_count[i], event_max_ns[i] / 1000.0);
+    }
+}
+#endif
+
+// Dispatch one event from the main loop
+void handle_event(XEvent *e) {
+    // Vblank notifications pace the redraw scheduler
+    if (redraw_handle_event(e)) {
+        return;
+    }
+    
+    // The compositor watches structure events too but only consumes damage
+    if (compositor_handle_event(e)) {
+        return;
+    }
+
+    // Let an open dialog take its own events first
+    if (lscreen_handle_event(e) || rundlg_handle_event(e) || switcher_handle_event(e)) {
+        return;
+    }
+
+    // Resize acknowledgements from syncing clients
+    if (syncreq_handle_event(e, window_list)) {
+        return;
+    }
+    
+    // Ping replies from clients
+    if (ping_handle_event(e, window_list)) {
+        return;
+    }
+    
+    // Screen layout changes refresh the monitor cache and retile
+    if (monitor_handle_event(e)) {
+        layout_dirty = 1;
+        return;
+    }
+    
+    switch (e->type) {
+        case KeyPress:
+            handle_keypress(&e->xkey);
+            break;
+        case MapRequest:
+            handle_map_request(&e->xmaprequest);
+            break;
+        case UnmapNotify:
+            handle_unmap_notify(&e->xunmap);
+            break;
+        case DestroyNotify:
+            handle_destroy_notify(&e->xdestroywindow);
+            break;
+        case ConfigureRequest:
+            handle_configure_request(&e->xconfigurerequest);
+            break;
+        case PropertyNotify:
+            // Title changes re-render only that window's cached title bar
+            if (e->xproperty.atom == XA_WM_NAME || e->xproperty.atom == net_wm_name) {
+                WindowNode *node = find_window(e->xproperty.window);
+                if (node) frame_update_title(node);
+                if (node && node == current_window) status_invalidate();
+            } else if (e->xproperty.atom == XA_WM_NORMAL_HINTS) {
+                WindowNode *node = find_window(e->xproperty.window);
+                if (node) update_size_hints(node);
+            }
+            break;
+        case ButtonPress:
+            handle_button_press(&e->xbutton);
+            break;
+        case MotionNotify: {
+            // Only the newest motion of a run at the head of the queue matters;
+            // stop at any other event so nothing is reordered around it
+            XEvent next;
+            while (XEventsQueued(dpy, QueuedAlready) > 0) {
+                XPeekEvent(dpy, &next);
+                if (next.type != MotionNotify || next.xmotion.window != e->xmotion.window) break;
+                XNextEvent(dpy, e);
+            }
+            drag_motion(&e->xmotion);
+            break;
+        }
+        case ButtonRelease:
+            drag_end();
+            break;
+        case MappingNotify:
+            // Keycodes or modifiers moved; rebuild the table and the grabs
+            XRefreshKeyboardMapping(&e->xmapping);
+            if (e->xmapping.request != MappingPointer) {
+                grab_keys();
+            }
+            if (e->xmapping.request == MappingModifier) {
+                switcher_refresh_modifiers();
+            }
+            break;
+        case ClientMessage:
+            // Pagers ask for desktop switches on the root window
+            if (e->xclient.message_type == net_current_desktop) {
+                switch_desktop(e->xclient.data.l[0]);
+            }
+            break;
+    }
+}
+
+// Signal handler: only async-signal-safe work here. The flag ends the main
+// loop and the pipe wakes it from poll; cleanup() runs from main().
 void signal_handler(int sig) {
-    cleanup();
-    exit(0);
+    int saved = errno;
+    signalled = 1;
+    if (signal_pipe[1] >= 0 && write(signal_pipe[1], "", 1) < 0) {
+        // A full pipe already holds a wakeup
+    }
+    errno = saved;
+}
+
+// Drain the wakeups written by signal_handler
+static void signal_wake(int fd, void *arg) {
+    char buf[16];
+    while (read(fd, buf, sizeof(buf)) > 0);
 }
 
 // Xlib error handler
@@ -605,11 +1764,43 @@ int xerror(Display *dpy, XErrorEvent *e) {
     return 0; // Continue execution
 }
 
-int main() {
-    // Setup signal handlers
+int main(int argc, char **argv) {
+    saved_argv = argv;
+    trace_init();
+    
+    // swm -p: read a password from stdin and store its salted hash
+    if (argc > 1 && !strcmp(argv[1], "-p")) {
+        char password[MAXPASS + 2] = {0};
+        if (!fgets(password, sizeof(password), stdin)) {
+            fprintf(stderr, "No password given\n");
+            return 1;
+        }
+        password[strcspn(password, "\n")] = '\0';
+        int ok = lscreen_write_hash(password);
+        memset(password, 0, sizeof(password));
+        return ok ? 0 : 1;
+    }
+
+    // swm -c: composite windows through an off-screen buffer
+    int composite = argc > 1 && !strcmp(argv[1], "-c");
+
+    // Setup signal handlers; the pipe lets them wake the event loop
+    if (pipe(signal_pipe) == 0) {
+        for (int i = 0; i < 2; i++) {
+            fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC);
+            fcntl(signal_pipe[i], F_SETFL, O_NONBLOCK);
+        }
+        evloop_add_fd(signal_pipe[0], signal_wake, NULL);
+    }
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
+    // Dialog text is UTF-8; fall back to the C locale if Xlib cannot handle ours
+    if (!setlocale(LC_CTYPE, "") || !XSupportsLocale()) {
+        setlocale(LC_CTYPE, "C");
+    }
+    XSetLocaleModifiers("");
+    
     // Open display
     dpy = XOpenDisplay(NULL);
     if (!dpy) {
@@ -620,42 +1811,64 @@ int main() {
     screen = DefaultScreen(dpy);
     root = RootWindow(dpy, screen);
     
+    // Round trips per handler and binding, in AUDIT builds; SIGUSR1 prints them
+    audit_init(dpy);
+    
+    // Resizes are paced by clients that support _NET_WM_SYNC_REQUEST
+    syncreq_init(dpy, sync_ready);
+    
+    // Clients that stop answering _NET_WM_PING are marked and can be killed
+    ping_init(dpy);
+    
+    // Runtime settings from $XDG_CONFIG_HOME/swm/config, re-applied when it changes
+    settings_init(apply_settings);
+    
+    // Window rules from the config, compiled into a lookup table
+    rules_init(dpy);
+    
     // Initialize EWMH
     init_ewmh();
     
     // Select events on root window
     XSelectInput(dpy, root, 
                 SubstructureRedirectMask | SubstructureNotifyMask |
-                KeyPressMask | KeyReleaseMask);
+                StructureNotifyMask | KeyPressMask | KeyReleaseMask);
+    
+    // Cache output geometry; refreshed only when the screen layout changes
+    monitor_init(dpy, screen);
+    
+    // Drawing is batched into one pass per frame, paced by the refresh rate
+    if (!redraw_init(dpy, screen)) {
+        fprintf(stderr, "Cannot initialize redraw scheduler\n");
+        cleanup();
+        return 1;
+    }
+    
+    if (!frame_init(dpy, screen)) {
+        fprintf(stderr, "Cannot initialize frames\n");
+        cleanup();
+        return 1;
+    }
+    
+    if (composite && !compositor_init(dpy, screen, window_damaged)) {
+        fprintf(stderr, "Compositing unavailable, drawing windows directly\n");
+    }
     
     // Set error handler to catch X errors gracefully
     XSetErrorHandler(xerror);
     
-    // Grab key combinations
-    XGrabKey(dpy, XKeysymToKeycode(dpy, XK_Tab), Mod1Mask, root, True,
-             GrabModeAsync, GrabModeAsync);
-    XGrabKey(dpy, XKeysymToKeycode(dpy, XK_F4), Mod1Mask, root, True,
-             GrabModeAsync, GrabModeAsync);
-    XGrabKey(dpy, XKeysymToKeycode(dpy, XK_d), Mod4Mask, root, True,
-             GrabModeAsync, GrabModeAsync);
-    XGrabKey(dpy, XKeysymToKeycode(dpy, XK_n), Mod4Mask, root, True,
-             GrabModeAsync, GrabModeAsync);
-    XGrabKey(dpy, XKeysymToKeycode(dpy, XK_l), Mod4Mask, root, True,
-             GrabModeAsync, GrabModeAsync);
-    XGrabKey(dpy, XKeysymToKeycode(dpy, XK_m), Mod4Mask, root, True,
-             GrabModeAsync, GrabModeAsync);
-    XGrabKey(dpy, XKeysymToKeycode(dpy, XK_r), Mod4Mask, root, True,
-             GrabModeAsync, GrabModeAsync);
-    XGrabKey(dpy, XKeysymToKeycode(dpy, XK_x), Mod4Mask, root, True,
-             GrabModeAsync, GrabModeAsync);
-    XGrabKey(dpy, XKeysymToKeycode(dpy, XK_z), Mod4Mask, root, True,
-             GrabModeAsync, GrabModeAsync);
+    // Grab the bindings from config.h and the Super+drag buttons
+    grab_keys();
+    
+    move_cursor = XCreateFontCursor(dpy, XC_fleur);
+    resize_cursor = XCreateFontCursor(dpy, XC_sizing);
     
     printf("Stacking Window Manager started\n");
     printf("Shortcuts:\n");
-    printf("  Alt+Tab: Switch windows\n");
+    printf("  Alt+Tab: Switch windows (hold Alt to pick from thumbnails)\n");
     printf("  Alt+F4: Close window\n");
     printf("  Super+Q: Quit window manager\n");
+    printf("  Super+Shift+R: Restart window manager, keeping window state\n");
     printf("  Super+D: Run dialog\n");
     printf("  Super+N: Minimize window\n");
     printf("  Super+L: Lock screen\n");
@@ -663,6 +1876,9 @@ int main() {
     printf("  Super+R: Restore minimized window\n");
     printf("  Super+X: Hide window\n");
     printf("  Super+Z: Unhide last hidden window\n");
+    printf("  Super+T: Cycle layout (floating, master-stack, grid)\n");
+    printf("  Super+Drag: Move window (right button: resize)\n");
+    printf("  Super+1..%d: Switch desktop (with Shift: move window)\n", NUM_DESKTOPS);
  
     if (status_init(dpy, screen)) {
         printf("Cannot initialize status bar.\n");
@@ -670,28 +1886,69 @@ int main() {
         return 1;
     }
 
+    // Create the dialogs up front so invoking them only maps a window
+    if (!rundlg_init(dpy, screen) || !lscreen_init(dpy, screen) ||
+        !switcher_init(dpy, screen, &window_list, focus_window)) {
+        printf("Cannot initialize dialogs.\n");
+        cleanup();
+        return 1;
+    }
+    
+    // Manage windows left by a previous swm (restart) or another session
+    adopt_windows();
+
     // Main event loop
     XEvent e;
-    while (running) {
+    while (running && !signalled) {
+        // Sleep until X or a watched descriptor (lock screen results, inotify) is ready
+        if (!XPending(dpy)) {
+            // Relayout once per burst of events rather than once per event
+            if (layout_dirty) {
+                TRACE_BEGIN("arrange");
+                arrange();
+                TRACE_END("arrange");
+                continue;
+            }
+            TRACE_BEGIN("evloop_wait");
+            evloop_wait(ConnectionNumber(dpy));
+            TRACE_END("evloop_wait");
+            audit_poll();
+            continue;
+        }
+        // A steady event stream must not hold back due timers such as frame redraws
+        evloop_run_timers();
         XNextEvent(dpy, &e);
-        
-        switch (e.type) {
-            case KeyPress:
-                handle_keypress(&e.xkey);
-                break;
-            case MapRequest:
-                handle_map_request(&e.xmaprequest);
-                break;
-            case UnmapNotify:
-                handle_unmap_notify(&e.xunmap);
-                break;
-            case DestroyNotify:
-                handle_destroy_notify(&e.xdestroywindow);
-                break;
-            case ConfigureRequest:
-                handle_configure_request(&e.xconfigurerequest);
-                break;
+
+#if defined(TRACE) || defined(AUDIT)
+        const char *span = e.type < LASTEvent && event_names[e.type] ? event_names[e.type] : "event";
+#endif
+        TRACE_BEGIN(span);
+        AUDIT_BEGIN(span);
+
+#ifdef TIMING
+        struct timespec start;
+        timer_start(&start);
+        handle_event(&e);
+        long ns = timer_elapsed_ns(&start);
+        if (e.type < LASTEvent) {
+            event_count[e.type]++;
+            event_total_ns[e.type] += ns;
+            if (ns > event_max_ns[e.type]) event_max_ns[e.type] = ns;
         }
+#else
+        handle_event(&e);
+#endif
+        AUDIT_END();
+        TRACE_END(span);
+    }
+    
+    // A restart re-executes swm, which picks the windows up again
+    if (restarting) {
+        save_state();
+        cleanup();
+        execvp(saved_argv[0], saved_argv);
+        perror("swm: restart failed");
+        return 1;
     }
     
     cleanup();
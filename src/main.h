@@ -4,6 +4,8 @@
 #define MAX_WINDOWS 256
 #define MAX_MINIMIZED 64
 #define MAX_HIDDEN 64
+#define BORDER_WIDTH 2
+#define NUM_DESKTOPS 4
 
 // Window states
 typedef enum {
@@ -18,6 +20,33 @@ typedef struct WindowNode {
     Window window;
     WindowState state;
     int x, y, width, height;  // Original dimensions for restore
+    int gx, gy, gwidth, gheight;  // Geometry last sent to the server
+    int desktop;
+    int ignore_unmap;  // UnmapNotify events caused by swm itself, not the client
+    Window frame;      // Decoration window the client is reparented into
+    char title[128];   // Cached _NET_WM_NAME or WM_NAME, drawn into the title pixmaps
+    Pixmap title_pm[2];  // Rendered title bar, inactive and active
+    int pm_width;
+    int active;
+    int title_stale;   // Title pixmaps need re-rendering at the next redraw
+    XID sync_counter;  // _NET_WM_SYNC_REQUEST_COUNTER, None if the client does not sync
+    XID sync_alarm;
+    long long sync_value;  // Last value sent in a sync request
+    int sync_waiting;  // A resize is out and not acknowledged yet
+    int sync_timer;
+    int pending;       // Geometry held back until the client catches up
+    int px, py, pwidth, pheight;
+    Pixmap thumb;      // Downscaled preview for the Alt+Tab switcher, None until captured
+    int thumb_width, thumb_height;
+    int thumb_dirty;   // Damaged since the last capture
+    int ping_supported;  // Client lists _NET_WM_PING
+    int ping_timer;    // Outstanding ping, 0 when none is in flight
+    long ping_serial;
+    int hung;          // Missed its last ping deadline
+    int ping_closing;  // Outstanding ping was sent after asking the client to close
+    int close_hung;    // Missed that ping: the next close kills it
+    int min_w, min_h, max_w, max_h;  // WM_NORMAL_HINTS in client pixels, 0 when unset
+    int inc_w, inc_h, base_w, base_h;
     struct WindowNode *next;
     struct WindowNode *prev;
 } WindowNode;
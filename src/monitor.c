@@ -0,0 +1,162 @@
+
+#include "monitor.h"
+#ifdef XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+
+static Display *dpy;
+static int scr;
+static Monitor monitors[MAX_MONITORS];
+static int count = 0;
+static int screen_width, screen_height;
+static int refresh_rate = DEFAULT_REFRESH_RATE;
+#ifdef XRANDR
+static int rr_event_base = -1;
+#endif
+
+/* The status bar thread reads the table while the main thread refreshes it */
+static pthread_mutex_t monitor_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Rebuild the monitor table; the only place geometry is queried from the server */
+static void monitor_update(int width, int height) {
+	Monitor table[MAX_MONITORS];
+	int n = 0;
+
+#ifdef XRANDR
+	if (rr_event_base >= 0) {
+		int nmon = 0;
+		XRRMonitorInfo *info = XRRGetMonitors(dpy, RootWindow(dpy, scr), True, &nmon);
+		for (int i = 0; info && i < nmon && n < MAX_MONITORS; i++) {
+			table[n].x = info[i].x;
+			table[n].y = info[i].y;
+			table[n].width = info[i].width;
+			table[n].height = info[i].height;
+
+			/* Keep the primary output first */
+			if (info[i].primary && n > 0) {
+				Monitor tmp = table[0];
+				table[0] = table[n];
+				table[n] = tmp;
+			}
+			n++;
+		}
+		if (info) XRRFreeMonitors(info);
+
+		/* Pace interactive redraws to the current mode */
+		XRRScreenConfiguration *conf = XRRGetScreenInfo(dpy, RootWindow(dpy, scr));
+		if (conf) {
+			short rate = XRRConfigCurrentRate(conf);
+			if (rate > 0) refresh_rate = rate;
+			XRRFreeScreenConfigInfo(conf);
+		}
+	}
+#endif
+
+	/* Without RandR the whole screen is one monitor */
+	if (n == 0) {
+		table[0].x = 0;
+		table[0].y = 0;
+		table[0].width = width;
+		table[0].height = height;
+		n = 1;
+	}
+
+	pthread_mutex_lock(&monitor_mutex);
+	for (int i = 0; i < n; i++) monitors[i] = table[i];
+	count = n;
+	screen_width = width;
+	screen_height = height;
+	pthread_mutex_unlock(&monitor_mutex);
+}
+
+/* Build the monitor table and ask to be told when it changes */
+int monitor_init(Display *display, int screen) {
+	dpy = display;
+	scr = screen;
+
+#ifdef XRANDR
+	int error_base, major = 0, minor = 0;
+	if (XRRQueryExtension(dpy, &rr_event_base, &error_base) &&
+			XRRQueryVersion(dpy, &major, &minor) && (major > 1 || (major == 1 && minor >= 5))) {
+		XRRSelectInput(dpy, RootWindow(dpy, scr), RRScreenChangeNotifyMask);
+	} else {
+		rr_event_base = -1;
+	}
+#endif
+
+	monitor_update(DisplayWidth(dpy, scr), DisplayHeight(dpy, scr));
+	return 1;
+}
+
+/* Refresh the table on screen changes; returns 1 if the event was consumed */
+int monitor_handle_event(XEvent *ev) {
+#ifdef XRANDR
+	if (rr_event_base >= 0 && ev->type == rr_event_base + RRScreenChangeNotify) {
+		XRRUpdateConfiguration(ev);
+		monitor_update(DisplayWidth(dpy, scr), DisplayHeight(dpy, scr));
+		return 1;
+	}
+#endif
+	if (ev->type == ConfigureNotify && ev->xconfigure.window == RootWindow(dpy, scr)) {
+#ifdef XRANDR
+		/* RandR reports the same change with the output layout */
+		if (rr_event_base >= 0) return 1;
+#endif
+		monitor_update(ev->xconfigure.width, ev->xconfigure.height);
+		return 1;
+	}
+	return 0;
+}
+
+/* Number of monitors */
+int monitor_count() {
+	pthread_mutex_lock(&monitor_mutex);
+	int n = count;
+	pthread_mutex_unlock(&monitor_mutex);
+	return n;
+}
+
+/* Monitor by index; index 0 is the primary output */
+Monitor monitor_get(int index) {
+	pthread_mutex_lock(&monitor_mutex);
+	Monitor m = monitors[index >= 0 && index < count ? index : 0];
+	pthread_mutex_unlock(&monitor_mutex);
+	return m;
+}
+
+/* Monitor containing a point, or the primary one if none does */
+Monitor monitor_at(int x, int y) {
+	pthread_mutex_lock(&monitor_mutex);
+	Monitor m = monitors[0];
+	for (int i = 0; i < count; i++) {
+		if (x >= monitors[i].x && x < monitors[i].x + monitors[i].width &&
+				y >= monitors[i].y && y < monitors[i].y + monitors[i].height) {
+			m = monitors[i];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&monitor_mutex);
+	return m;
+}
+
+/* Copy the table for callers that walk every monitor */
+int monitor_snapshot(Monitor *out, int max) {
+	pthread_mutex_lock(&monitor_mutex);
+	int n = count < max ? count : max;
+	for (int i = 0; i < n; i++) out[i] = monitors[i];
+	pthread_mutex_unlock(&monitor_mutex);
+	return n;
+}
+
+/* Cached size of the whole X screen */
+void monitor_screen_size(int *width, int *height) {
+	pthread_mutex_lock(&monitor_mutex);
+	*width = screen_width;
+	*height = screen_height;
+	pthread_mutex_unlock(&monitor_mutex);
+}
+
+/* Refresh rate of the current mode in Hz; DEFAULT_REFRESH_RATE without RandR */
+int monitor_refresh_rate() {
+	return refresh_rate;
+}
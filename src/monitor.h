@@ -0,0 +1,24 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <X11/Xlib.h>
+#include <pthread.h>
+
+#define MAX_MONITORS 16
+#define DEFAULT_REFRESH_RATE 60
+
+/* Geometry of one output, in root window coordinates */
+typedef struct {
+	int x, y, width, height;
+} Monitor;
+
+int monitor_init(Display *display, int screen);
+int monitor_handle_event(XEvent *ev);
+int monitor_count();
+Monitor monitor_get(int index);
+Monitor monitor_at(int x, int y);
+int monitor_snapshot(Monitor *out, int max);
+void monitor_screen_size(int *width, int *height);
+int monitor_refresh_rate();
+
+#endif /* MONITOR_H */
@@ -0,0 +1,109 @@
+#include "ping.h"
+#include "evloop.h"
+#include "frame.h"
+#include "trace.h"
+
+static Display *dpy;
+static Window root;
+static Atom wm_protocols, net_wm_ping;
+static long ping_serial = 0;
+
+void ping_init(Display *display) {
+	dpy = display;
+	root = DefaultRootWindow(dpy);
+	wm_protocols = XInternAtom(dpy, "WM_PROTOCOLS", False);
+	net_wm_ping = XInternAtom(dpy, "_NET_WM_PING", False);
+}
+
+/* Atom to list in _NET_SUPPORTED */
+Atom ping_atom() {
+	return net_wm_ping;
+}
+
+/* Clients that do not list _NET_WM_PING in WM_PROTOCOLS are never pinged */
+void ping_manage(WindowNode *node) {
+	Atom *protocols;
+	int n;
+
+	node->ping_supported = 0;
+	node->ping_timer = 0;
+	node->ping_serial = 0;
+	node->hung = 0;
+	node->ping_closing = 0;
+	node->close_hung = 0;
+	if (!TRACE_X("XGetWMProtocols", XGetWMProtocols(dpy, node->window, &protocols, &n))) return;
+	for (int i = 0; i < n; i++) {
+		if (protocols[i] == net_wm_ping) node->ping_supported = 1;
+	}
+	XFree(protocols);
+}
+
+void ping_unmanage(WindowNode *node) {
+	if (node->ping_timer) evloop_cancel_timer(node->ping_timer);
+	node->ping_timer = 0;
+	node->ping_supported = 0;
+}
+
+static void ping_timeout(void *arg) {
+	WindowNode *node = arg;
+	node->ping_timer = 0;
+	if (node->ping_closing) node->close_hung = 1;
+	if (!node->hung) frame_set_hung(node, 1);
+
+	/* Keep pinging so the mark clears as soon as the client recovers */
+	ping_send(node);
+}
+
+/* Ask the client to echo a ping back to the root window; never waits for the answer.
+ * A hung client keeps being re-pinged so it is unmarked as soon as it recovers. */
+void ping_send(WindowNode *node) {
+	if (!node->ping_supported || node->ping_timer) return;
+
+	/* The serial stands in for the timestamp and identifies the reply */
+	node->ping_serial = ++ping_serial & 0xFFFFFFFFL;
+	node->ping_closing = 0;
+	XEvent ev;
+	ev.xclient.type = ClientMessage;
+	ev.xclient.window = node->window;
+	ev.xclient.message_type = wm_protocols;
+	ev.xclient.format = 32;
+	ev.xclient.data.l[0] = net_wm_ping;
+	ev.xclient.data.l[1] = node->ping_serial;
+	ev.xclient.data.l[2] = node->window;
+	ev.xclient.data.l[3] = 0;
+	ev.xclient.data.l[4] = 0;
+	XSendEvent(dpy, node->window, False, NoEventMask, &ev);
+
+	node->ping_timer = evloop_add_timer(PING_TIMEOUT_US, ping_timeout, node);
+}
+
+/* Ping right after a close request. Only a miss on this ping makes the client
+ * killable; one in flight from a focus change was sent before the close. */
+void ping_close(WindowNode *node) {
+	if (!node->ping_supported) return;
+	if (node->ping_timer) evloop_cancel_timer(node->ping_timer);
+	node->ping_timer = 0;
+	ping_send(node);
+	node->ping_closing = 1;
+}
+
+/* Handle pongs sent back to the root window; returns 1 if the event was consumed */
+int ping_handle_event(XEvent *ev, WindowNode *list) {
+	if (ev->type != ClientMessage || ev->xclient.window != root ||
+			ev->xclient.message_type != wm_protocols || (Atom)ev->xclient.data.l[0] != net_wm_ping) {
+		return 0;
+	}
+
+	for (WindowNode *node = list; node; node = node->next) {
+		if (node->window != (Window)ev->xclient.data.l[2]) continue;
+		if (node->ping_serial == ev->xclient.data.l[1]) {
+			if (node->ping_timer) evloop_cancel_timer(node->ping_timer);
+			node->ping_timer = 0;
+			node->ping_closing = 0;
+			node->close_hung = 0;
+			if (node->hung) frame_set_hung(node, 0);
+		}
+		break;
+	}
+	return 1;
+}
@@ -0,0 +1,17 @@
+#ifndef PING_H
+#define PING_H
+
+#include <X11/Xlib.h>
+#include "main.h"
+
+#define PING_TIMEOUT_US 2000000  /* A client this slow to answer is marked as not responding */
+
+void ping_init(Display *display);
+Atom ping_atom();
+void ping_manage(WindowNode *node);
+void ping_unmanage(WindowNode *node);
+void ping_send(WindowNode *node);
+void ping_close(WindowNode *node);
+int ping_handle_event(XEvent *ev, WindowNode *list);
+
+#endif /* PING_H */
@@ -0,0 +1,176 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "redraw.h"
+#ifdef PRESENT
+#include <X11/extensions/Xpresent.h>
+#endif
+#include "evloop.h"
+#include "monitor.h"
+#include "trace.h"
+#include "util.h"
+
+/* Modules mark what needs drawing; everything marked until the next frame
+ * boundary is drawn in one pass and sent with one flush. Marking the same
+ * object again before then is free. */
+typedef struct {
+	redraw_fn draw;
+	void *arg;
+} redraw_t;
+
+static Display *dpy;
+static Window root;
+static redraw_t pending[REDRAW_MAX];
+static int npending = 0;
+static int frame_timer = 0;
+static struct timespec last_frame;
+static int wake_pipe[2] = { -1, -1 };
+
+#ifdef PRESENT
+static int present_opcode = -1;
+static XID present_events = None;
+static uint32_t present_serial = 0;
+static int vblank_wait = 0;
+#endif
+
+static long frame_interval_us() {
+	return 1000000L / monitor_refresh_rate();
+}
+
+/* Draw every marked object, then flush once */
+static void redraw_frame() {
+	redraw_t batch[REDRAW_MAX];
+	int n = npending;
+
+	if (frame_timer) evloop_cancel_timer(frame_timer);
+	frame_timer = 0;
+#ifdef PRESENT
+	vblank_wait = 0;
+#endif
+
+	TRACE_BEGIN("redraw_frame");
+	/* Anything marked while drawing waits for the next frame */
+	memcpy(batch, pending, n * sizeof(redraw_t));
+	npending = 0;
+	for (int i = 0; i < n; i++) {
+		if (batch[i].draw) batch[i].draw(batch[i].arg);
+	}
+	XFlush(dpy);
+	timer_start(&last_frame);
+	TRACE_END("redraw_frame");
+}
+
+static void redraw_timer(void *arg) {
+	frame_timer = 0;
+	redraw_frame();
+}
+
+/* Draw at the next vblank when Present is there, else at the next frame
+ * boundary counted from the last one. After a quiet spell that boundary has
+ * already passed, so the timer fires before the next event is handled. */
+static void redraw_schedule() {
+	if (frame_timer) return;
+
+#ifdef PRESENT
+	if (present_opcode >= 0) {
+		XPresentNotifyMSC(dpy, root, ++present_serial, 0, 1, 0);
+		vblank_wait = 1;
+		frame_timer = evloop_add_timer(REDRAW_VBLANK_TIMEOUT_US, redraw_timer, NULL);
+		if (!frame_timer) redraw_frame();
+		return;
+	}
+#endif
+
+	long delay = frame_interval_us() - timer_elapsed_us(&last_frame);
+	frame_timer = evloop_add_timer(delay > 0 ? delay : 0, redraw_timer, NULL);
+	if (!frame_timer) redraw_frame();
+}
+
+/* Queue an object for the next frame; main thread only */
+void redraw_mark(redraw_fn draw, void *arg) {
+	for (int i = 0; i < npending; i++) {
+		if (pending[i].draw == draw && pending[i].arg == arg) return;
+	}
+	if (npending == REDRAW_MAX) redraw_frame();
+	pending[npending].draw = draw;
+	pending[npending].arg = arg;
+	npending++;
+	redraw_schedule();
+}
+
+static void redraw_wake(int fd, void *arg) {
+	redraw_t r;
+	while (read(fd, &r, sizeof(r)) == sizeof(r)) redraw_mark(r.draw, r.arg);
+}
+
+/* Queue from another thread; the request reaches the main loop through a pipe,
+ * whose writes this small are atomic. A full pipe means earlier marks are
+ * still unread, and those draw the same things. */
+void redraw_mark_async(redraw_fn draw, void *arg) {
+	redraw_t r = { draw, arg };
+	if (wake_pipe[1] >= 0 && write(wake_pipe[1], &r, sizeof(r)) < 0) return;
+}
+
+/* Drop queued draws of an object that is going away */
+void redraw_forget(void *arg) {
+	for (int i = 0; i < npending; i++) {
+		if (pending[i].arg == arg) pending[i].draw = NULL;
+	}
+}
+
+int redraw_init(Display *display, int screen) {
+	dpy = display;
+	root = RootWindow(dpy, screen);
+	timer_start(&last_frame);
+
+	if (pipe(wake_pipe) < 0) return 0;
+	for (int i = 0; i < 2; i++) {
+		fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC);
+		fcntl(wake_pipe[i], F_SETFL, O_NONBLOCK);
+	}
+	evloop_add_fd(wake_pipe[0], redraw_wake, NULL);
+
+#ifdef PRESENT
+	int event_base, error_base;
+	if (XPresentQueryExtension(dpy, &present_opcode, &event_base, &error_base)) {
+		present_events = XPresentSelectInput(dpy, root, PresentCompleteNotifyMask);
+	} else {
+		present_opcode = -1;
+	}
+#endif
+	return 1;
+}
+
+/* Vblank notifications from Present; returns 1 if the event was one */
+int redraw_handle_event(XEvent *ev) {
+#ifdef PRESENT
+	if (ev->type != GenericEvent || ev->xcookie.extension != present_opcode) return 0;
+	if (!XGetEventData(dpy, &ev->xcookie)) return 1;
+	if (ev->xcookie.evtype == PresentCompleteNotify) {
+		XPresentCompleteNotifyEvent *ce = ev->xcookie.data;
+		if (vblank_wait && ce->serial_number == present_serial) redraw_frame();
+	}
+	XFreeEventData(dpy, &ev->xcookie);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+void redraw_free() {
+	if (frame_timer) evloop_cancel_timer(frame_timer);
+	frame_timer = 0;
+	npending = 0;
+#ifdef PRESENT
+	if (present_events != None) XPresentFreeInput(dpy, root, present_events);
+	present_events = None;
+#endif
+	if (wake_pipe[0] >= 0) {
+		evloop_remove_fd(wake_pipe[0]);
+		close(wake_pipe[0]);
+		close(wake_pipe[1]);
+		wake_pipe[0] = wake_pipe[1] = -1;
+	}
+}
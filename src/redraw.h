@@ -0,0 +1,19 @@
+#ifndef REDRAW_H
+#define REDRAW_H
+
+#include <X11/Xlib.h>
+
+#define REDRAW_MAX 64               /* Distinct objects that can wait for one frame */
+#define REDRAW_VBLANK_TIMEOUT_US 100000  /* Draw anyway if a vblank event goes missing */
+
+/* Draws one dirty object; called at most once per frame however often it was marked */
+typedef void (*redraw_fn)(void *arg);
+
+int redraw_init(Display *display, int screen);
+void redraw_mark(redraw_fn draw, void *arg);
+void redraw_mark_async(redraw_fn draw, void *arg);
+void redraw_forget(void *arg);
+int redraw_handle_event(XEvent *ev);
+void redraw_free();
+
+#endif /* REDRAW_H */
@@ -0,0 +1,204 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rules.h"
+#include "trace.h"
+#include <X11/Xatom.h>
+#ifdef XCB_PROPS
+#include <X11/Xlib-xcb.h>
+#endif
+
+/* Rules are indexed by their exact (class, role, type) key; a "*" field is
+ * stored empty. Matching probes the table once per wildcard combination, so a
+ * new window costs eight lookups whether the config has five rules or five
+ * hundred. Rules sharing a key are merged at compile time. */
+typedef struct Rule {
+	char class[RULE_FIELD_LEN];
+	char role[RULE_FIELD_LEN];
+	Atom type;
+	RuleAction action;
+	struct Rule *next;
+} Rule;
+
+static Display *dpy;
+static Atom wm_window_role, net_wm_window_type;
+static Rule *buckets[RULES_BUCKETS];
+static Rule *pool = NULL;
+static int nrules = 0;
+
+/* Wildcard masks (bit 0 class, bit 1 role, bit 2 type), least specific first
+ * so later, more specific matches override earlier ones */
+static const int probe_order[] = { 7, 6, 5, 3, 4, 2, 1, 0 };
+
+/* FNV-1a over the key fields */
+static uint32_t hash_key(const char *class, const char *role, Atom type) {
+	uint32_t h = 2166136261u;
+	for (const char *p = class; *p; p++) h = (h ^ (unsigned char)*p) * 16777619u;
+	h = (h ^ 0xFF) * 16777619u;
+	for (const char *p = role; *p; p++) h = (h ^ (unsigned char)*p) * 16777619u;
+	h = (h ^ 0xFF) * 16777619u;
+	for (int i = 0; i < 4; i++) h = (h ^ ((type >> (i * 8)) & 0xFF)) * 16777619u;
+	return h & (RULES_BUCKETS - 1);
+}
+
+static Rule *lookup(const char *class, const char *role, Atom type) {
+	for (Rule *r = buckets[hash_key(class, role, type)]; r; r = r->next) {
+		if (r->type == type && !strcmp(r->class, class) && !strcmp(r->role, role)) return r;
+	}
+	return NULL;
+}
+
+static void merge(RuleAction *into, const RuleAction *from) {
+	if (from->desktop >= 0) into->desktop = from->desktop;
+	if (from->maximized >= 0) into->maximized = from->maximized;
+	if (from->nofocus >= 0) into->nofocus = from->nofocus;
+}
+
+void rules_init(Display *display) {
+	dpy = display;
+	wm_window_role = XInternAtom(dpy, "WM_WINDOW_ROLE", False);
+	net_wm_window_type = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
+	rules_compile(settings_get());
+}
+
+/* Rebuild the table from a settings snapshot. Type names like "dialog" are
+ * resolved to _NET_WM_WINDOW_TYPE_DIALOG here, once, rather than per window. */
+void rules_compile(const Settings *s) {
+	free(pool);
+	pool = NULL;
+	nrules = 0;
+	memset(buckets, 0, sizeof(buckets));
+	if (s->nrules == 0) return;
+
+	pool = calloc(s->nrules, sizeof(Rule));
+	if (!pool) return;
+
+	for (int i = 0; i < s->nrules; i++) {
+		const RuleSpec *spec = &s->rules[i];
+		const char *class = strcmp(spec->class, "*") ? spec->class : "";
+		const char *role = strcmp(spec->role, "*") ? spec->role : "";
+		Atom type = None;
+
+		if (strcmp(spec->type, "*")) {
+			char name[sizeof("_NET_WM_WINDOW_TYPE_") + RULE_FIELD_LEN];
+			char *p = name + strlen(strcpy(name, "_NET_WM_WINDOW_TYPE_"));
+			for (const char *c = spec->type; *c; c++) {
+				*p++ = (*c >= 'a' && *c <= 'z') ? *c - 'a' + 'A' : *c;
+			}
+			*p = '\0';
+			type = XInternAtom(dpy, name, False);
+		}
+
+		RuleAction action = { spec->desktop, spec->maximized, spec->nofocus };
+		Rule *r = lookup(class, role, type);
+		if (r) {
+			merge(&r->action, &action);
+			continue;
+		}
+		r = &pool[nrules++];
+		strcpy(r->class, class);
+		strcpy(r->role, role);
+		r->type = type;
+		r->action = action;
+		uint32_t h = hash_key(class, role, type);
+		r->next = buckets[h];
+		buckets[h] = r;
+	}
+}
+
+/* Copy a STRING property value, NUL-terminated, into a field-sized buffer */
+static void copy_field(char *dst, const char *src, int len) {
+	if (len >= RULE_FIELD_LEN) len = RULE_FIELD_LEN - 1;
+	if (len < 0) len = 0;
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+/* WM_CLASS is "instance\0class\0"; rules match the class half */
+static void copy_class(char *dst, const char *src, int len) {
+	int inst = strnlen(src, len);
+	if (inst < len) copy_field(dst, src + inst + 1, strnlen(src + inst + 1, len - inst - 1));
+	else dst[0] = '\0';
+}
+
+#ifdef XCB_PROPS
+/* All three requests are written before the first reply is awaited, so a
+ * new window costs one round trip however many properties rules look at */
+static void fetch_props(Window win, char *class, char *role, Atom *type) {
+	xcb_connection_t *c = XGetXCBConnection(dpy);
+	xcb_get_property_cookie_t cookies[3];
+	xcb_get_property_reply_t *reply;
+
+	cookies[0] = xcb_get_property(c, 0, win, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 0, RULES_PROP_LONGS);
+	cookies[1] = xcb_get_property(c, 0, win, wm_window_role, XCB_ATOM_STRING, 0, RULES_PROP_LONGS);
+	cookies[2] = xcb_get_property(c, 0, win, net_wm_window_type, XCB_ATOM_ATOM, 0, 1);
+
+	TRACE_X_BEGIN("xcb_get_property_reply");
+	if ((reply = xcb_get_property_reply(c, cookies[0], NULL))) {
+		copy_class(class, xcb_get_property_value(reply), xcb_get_property_value_length(reply));
+		free(reply);
+	}
+	if ((reply = xcb_get_property_reply(c, cookies[1], NULL))) {
+		copy_field(role, xcb_get_property_value(reply), xcb_get_property_value_length(reply));
+		free(reply);
+	}
+	if ((reply = xcb_get_property_reply(c, cookies[2], NULL))) {
+		if (xcb_get_property_value_length(reply) >= 4) *type = *(uint32_t *)xcb_get_property_value(reply);
+		free(reply);
+	}
+	TRACE_X_END("xcb_get_property_reply");
+}
+#else
+/* Without Xlib-xcb every property is its own round trip */
+static void fetch_props(Window win, char *class, char *role, Atom *type) {
+	Atom actual;
+	int format;
+	unsigned long n, after;
+	unsigned char *data;
+
+	if (TRACE_X("XGetWindowProperty", XGetWindowProperty(dpy, win, XA_WM_CLASS, 0, RULES_PROP_LONGS,
+			False, XA_STRING, &actual, &format, &n, &after, &data)) == Success && data) {
+		copy_class(class, (char *)data, n);
+		XFree(data);
+	}
+	if (TRACE_X("XGetWindowProperty", XGetWindowProperty(dpy, win, wm_window_role, 0, RULES_PROP_LONGS,
+			False, XA_STRING, &actual, &format, &n, &after, &data)) == Success && data) {
+		copy_field(role, (char *)data, n);
+		XFree(data);
+	}
+	if (TRACE_X("XGetWindowProperty", XGetWindowProperty(dpy, win, net_wm_window_type, 0, 1,
+			False, XA_ATOM, &actual, &format, &n, &after, &data)) == Success && data) {
+		if (n > 0) *type = *(Atom *)data;
+		XFree(data);
+	}
+}
+#endif
+
+/* Fill in what the rules say about a window about to be mapped; returns 0
+ * when none matched. With no rules configured nothing is fetched at all. */
+int rules_match(Window win, RuleAction *action) {
+	char class[RULE_FIELD_LEN] = "", role[RULE_FIELD_LEN] = "";
+	Atom type = None;
+	int matched = 0;
+
+	action->desktop = action->maximized = action->nofocus = -1;
+	if (nrules == 0) return 0;
+
+	fetch_props(win, class, role, &type);
+	for (size_t i = 0; i < sizeof(probe_order) / sizeof(probe_order[0]); i++) {
+		int mask = probe_order[i];
+		Rule *r = lookup((mask & 1) ? "" : class, (mask & 2) ? "" : role, (mask & 4) ? None : type);
+		if (r) {
+			merge(action, &r->action);
+			matched = 1;
+		}
+	}
+	return matched;
+}
+
+void rules_free() {
+	free(pool);
+	pool = NULL;
+	nrules = 0;
+	memset(buckets, 0, sizeof(buckets));
+}
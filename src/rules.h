@@ -0,0 +1,22 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include <X11/Xlib.h>
+#include "settings.h"
+
+#define RULES_BUCKETS 1024  /* Power of two, comfortably above SETTINGS_MAX_RULES */
+#define RULES_PROP_LONGS 64 /* Longest WM_CLASS or WM_WINDOW_ROLE read, in 32-bit units */
+
+/* Merged outcome of every rule matching a window; -1 leaves swm's default */
+typedef struct {
+	int desktop;
+	int maximized;
+	int nofocus;
+} RuleAction;
+
+void rules_init(Display *display);
+void rules_compile(const Settings *s);
+int rules_match(Window win, RuleAction *action);
+void rules_free();
+
+#endif /* RULES_H */
@@ -1,116 +1,138 @@
 #include "rundlg.h"
+#include "redraw.h"
+#include "trace.h"
 #include "util.h"
 
 static rundlg_t rundlg;
 
-/* Initialize the lock screen */
+/* Hide the dialog and give input back; it is kept for the next invocation */
+static void rundlg_hide() {
+	rundlg.active = 0;
+	XUnmapWindow(rundlg.display, rundlg.window);
+
+	/* Ungrab input before restoring focus */
+	XUngrabKeyboard(rundlg.display, CurrentTime);
+	XUngrabPointer(rundlg.display, CurrentTime);
+
+	/* Restore hotkeys and focus */
+	if (rundlg.prev_focused_win) {
+		XSetInputFocus(rundlg.display, rundlg.prev_focused_win, rundlg.prev_revert_to, CurrentTime);
+	} else {
+		XSetInputFocus(rundlg.display, RootWindow(rundlg.display, rundlg.screen), PointerRoot, CurrentTime);
+	}
+	XFlush(rundlg.display);
+}
+
+/* Handle a key press while the dialog is open */
+static void rundlg_keypress(XEvent *ev) {
+	KeySym key = XLookupKeysym(&ev->xkey, 0);
+	if (key == XK_Escape) {
+		widget_set_text(rundlg.input, "");
+		widget_invalidate(rundlg.wm, rundlg.input);
+	} else if (key == XK_Return) {
+		/* Accept input field entry */
+		spawn(widget_get_text(rundlg.input));
+		rundlg_hide();
+	} else {
+		/* Everything else edits the input field, wherever focus is */
+		ev->xkey.window = rundlg.window;
+		widget_manager_handle_event(rundlg.wm, ev);
+	}
+}
+
+/* Create the run dialog once; it stays unmapped until shown */
 int rundlg_init(Display *display, int screen) {
 	rundlg.display = display;
 	rundlg.screen = screen;
 
-	/* Store the current focused window before locking */
-	XGetInputFocus(display, &rundlg.prev_focused_win, &rundlg.prev_revert_to);
-
 	/* Create the simple window */
 	rundlg.window = XCreateSimpleWindow(display, RootWindow(display, screen), 0, 0, 400, 200, 1, 0, WhitePixel(display, screen));
 	if (rundlg.window == None) return 0;
 	XSelectInput(display, rundlg.window, ExposureMask | KeyPressMask);
 
-	/* Create the graphics context for window */
-	rundlg.gc = XCreateGC(rundlg.display, rundlg.window, 0, NULL);
-	if (!rundlg.gc) {
+	/* The input field is a toolkit textbox */
+	rundlg.wm = widget_manager_create(display);
+	if (!rundlg.wm) {
 		XDestroyWindow(display, rundlg.window);
+		rundlg.window = None;
 		return 0;
 	}
-
-	/* Create the font */
-	rundlg.font = XLoadQueryFont(rundlg.display, "fixed");
-	if (rundlg.font) {
-		XSetFont(display, rundlg.gc, rundlg.font->fid);
-	}
-
-	rundlg.input_field = XCreateSimpleWindow(display, rundlg.window, (400 - 300) / 2, 200 / 2 - 10, 300, 20, 1, 0, WhitePixel(display, screen));
-	if (!rundlg.input_field) {
+	rundlg.input = widget_create_textbox(rundlg.wm, rundlg.window, (400 - 300) / 2, 200 / 2 - 10, 300, 20, MAXLEN - 1);
+	if (!rundlg.input) {
+		widget_manager_destroy(rundlg.wm);
 		XDestroyWindow(display, rundlg.window);
+		rundlg.window = None;
 		return 0;
 	}
-	XSelectInput(display, rundlg.input_field, KeyPressMask);
-
-	memset(rundlg.input_text, 0, sizeof(rundlg.input_text)-1);
-	rundlg.input_len = 0;
 	return 1;
 }
 
-/* Run the main loop */
+/* Reset and map the dialog; events are then fed by rundlg_handle_event() */
 void rundlg_show() {
+	if (rundlg.active) return;
+
+#ifdef TIMING
+	struct timespec start;
+	timer_start(&start);
+#endif
+
+	/* Reset state left over from the previous invocation */
+	widget_set_text(rundlg.input, "");
+	widget_invalidate(rundlg.wm, rundlg.input);
+
+	/* Store the current focused window before showing */
+	TRACE_X("XGetInputFocus", XGetInputFocus(rundlg.display, &rundlg.prev_focused_win, &rundlg.prev_revert_to));
+
 	/* Grab input */
-	XGrabKeyboard(rundlg.display, RootWindow(rundlg.display, rundlg.screen), True, GrabModeAsync, GrabModeAsync, CurrentTime);
-	XGrabPointer(rundlg.display, RootWindow(rundlg.display, rundlg.screen), True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
+	TRACE_X("XGrabKeyboard", XGrabKeyboard(rundlg.display, RootWindow(rundlg.display, rundlg.screen), True, GrabModeAsync, GrabModeAsync, CurrentTime));
+	TRACE_X("XGrabPointer", XGrabPointer(rundlg.display, RootWindow(rundlg.display, rundlg.screen), True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None, None, CurrentTime));
 
 	/* Display the window */
 	XMapRaised(rundlg.display, rundlg.window);
-	XMapWindow(rundlg.display, rundlg.input_field);
-	XSetInputFocus(rundlg.display, rundlg.window, RevertToParent, CurrentTime);
+	widget_set_focus(rundlg.wm, rundlg.input);
+	rundlg.active = 1;
+
+#ifdef TIMING
 	XSync(rundlg.display, False);
+	fprintf(stderr, "rundlg: shown in %ld us\n", timer_elapsed_us(&start));
+#else
 	XFlush(rundlg.display);
+#endif
+}
 
-	XEvent ev;
-	for (;;) {
-		XNextEvent(rundlg.display, &ev);
-		if (ev.type == Expose) {
-			XClearWindow(rundlg.display, rundlg.input_field);
-			XDrawString(rundlg.display, rundlg.input_field, rundlg.gc, 5, 12, rundlg.input_text, rundlg.input_len);
-			XFlush(rundlg.display);
-		} else if (ev.type == KeyPress) {
-			KeySym key = XLookupKeysym(&ev.xkey, 0);
-			if (key == XK_Escape) {
-                memset(rundlg.input_text, 0, MAXLEN);
-                rundlg.input_len = 0;
-			} else if (key == XK_Return) {
-				/* Accept input field entry */
-				spawn(rundlg.input_text);
-                memset(rundlg.input_text, 0, MAXLEN);
-                rundlg.input_len = 0;
-				XUnmapWindow(rundlg.display, rundlg.input_field);
-				XUnmapWindow(rundlg.display, rundlg.window);
-                break;
-			} else if (key == XK_BackSpace && rundlg.input_len > 0) {
-				rundlg.input_text[--rundlg.input_len] = '\0';
-			} else if (rundlg.input_len < (int)(sizeof(rundlg.input_text)-1) && key >= XK_space && key <= XK_asciitilde) {
-				/* Handle input field */
-                char buffer[10];
-                XComposeStatus compose;
-                int len = XLookupString(&ev.xkey, buffer, sizeof(buffer)-1, &key, &compose);
-                buffer[len] = '\0';
-                rundlg.input_text[rundlg.input_len++] = buffer[0];
-                rundlg.input_text[rundlg.input_len] = '\0';
-			}
-
-			XClearWindow(rundlg.display, rundlg.input_field);
-			XDrawString(rundlg.display, rundlg.input_field, rundlg.gc, 5, 12, rundlg.input_text, rundlg.input_len);
-			XFlush(rundlg.display);
-		}
-	}
-
-	/* Ungrab input before restoring focus */
-	XUngrabKeyboard(rundlg.display, CurrentTime);
-	XUngrabPointer(rundlg.display, CurrentTime);
-	XFlush(rundlg.display);
+/* Scheduled redraw of the widgets invalidated since the last frame */
+static void rundlg_draw(void *arg) {
+	if (rundlg.active) widget_manager_flush(rundlg.wm);
+}
 
-	/* Restore hotkeys and focus */
-	if (rundlg.prev_focused_win) {
-		XSetInputFocus(rundlg.display, rundlg.prev_focused_win, rundlg.prev_revert_to, CurrentTime);
-	} else {
-		XSetInputFocus(rundlg.display, RootWindow(rundlg.display, rundlg.screen), PointerRoot, CurrentTime);
+/* Dispatch an event from the main loop; returns 1 if the dialog consumed it */
+int rundlg_handle_event(XEvent *ev) {
+	if (!rundlg.active) return 0;
+
+	switch (ev->type) {
+		case KeyPress:
+			rundlg_keypress(ev);
+			break;
+		case KeyRelease:
+		case ButtonPress:
+		case ButtonRelease:
+		case MotionNotify:
+			/* Input is grabbed by the dialog */
+			break;
+		default:
+			if (!widget_manager_handle_event(rundlg.wm, ev) && ev->xany.window != rundlg.window) return 0;
+			break;
 	}
 
-    XFlush(rundlg.display);
+	/* Repaint only what the event invalidated, once per frame */
+	if (rundlg.active) redraw_mark(rundlg_draw, NULL);
+	return 1;
 }
 
-/* Free the lock screen */
+/* Free the run dialog */
 void rundlg_free() {
-	XFreeGC(rundlg.display, rundlg.gc);
-	XFreeFont(rundlg.display, rundlg.font);
-	XDestroyWindow(rundlg.display, rundlg.input_field);
+	if (rundlg.window == None) return;
+	widget_manager_destroy(rundlg.wm);
 	XDestroyWindow(rundlg.display, rundlg.window);
+	rundlg.window = None;
 }
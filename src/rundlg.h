@@ -8,24 +8,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "widgets.h"
 
-#define MAXLEN 64
+#define MAXLEN 4096
 
 typedef struct _rundlg {
 	Display *display;
 	int screen;
-	GC gc;
-	XFontStruct *font;
+	WidgetManager *wm;
+	Widget *input;
 	Window window;
-	Window input_field;
 	Window prev_focused_win;
-	char input_text[MAXLEN];
-	int input_len;
 	int prev_revert_to;
+	int active;
 } rundlg_t;
 
 int rundlg_init(Display *d, int screen);
 void rundlg_show();
+int rundlg_handle_event(XEvent *ev);
 void rundlg_free();
 
 #endif // RUNDLG_H
\ No newline at end of file
@@ -0,0 +1,333 @@
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "settings.h"
+#include "evloop.h"
+#include "main.h"
+#include "status.h"
+#include "lscreen.h"
+
+static Settings initial;
+static _Atomic(Settings *) current = &initial;
+static Settings *retired = NULL;  /* Previous snapshot, freed on the swap after next */
+static settings_apply_fn apply_fn;
+static char path[PATH_MAX];
+static char dir[PATH_MAX - sizeof("/config")];
+static int inotify_fd = -1;
+static int dir_wd = -1;     /* Watch on the config directory itself */
+static int parent_wd = -1;  /* Watch on its parent while the directory is missing */
+
+static void settings_defaults(Settings *s) {
+	memset(s, 0, sizeof(Settings));
+	s->border_width = BORDER_WIDTH;
+	s->bar_height = BAR_HEIGHT;
+	s->update_interval = UPDATE_INTERVAL;
+	s->lock_blur = LOCK_BLUR;
+	strcpy(s->font, "fixed");
+	s->border_color = 0xFFFFFF;
+	s->border_color_inactive = 0x000000;
+	s->bar_background = 0x000000;
+	s->bar_foreground = 0xFFFFFF;
+}
+
+static int parse_int(const char *v, int min, int max, int *out) {
+	char *end;
+	long n = strtol(v, &end, 10);
+	if (end == v || *end || n < min || n > max) return 0;
+	*out = n;
+	return 1;
+}
+
+/* #rrggbb */
+static int parse_color(const char *v, unsigned long *out) {
+	char *end;
+	if (v[0] != '#' || strlen(v) != 7) return 0;
+	unsigned long c = strtoul(v + 1, &end, 16);
+	if (*end) return 0;
+	*out = c;
+	return 1;
+}
+
+/* "Mod4+Shift+d action [argument]" */
+static int parse_binding(const char *v, Binding *b) {
+	char spec[128], action[SETTINGS_ACTION_LEN];
+	int arg = 0;
+
+	int n = sscanf(v, "%127s %31s %d", spec, action, &arg);
+	if (n < 2) return 0;
+
+	b->mod = 0;
+	char *key = spec;
+	for (char *plus; (plus = strchr(key, '+')); key = plus + 1) {
+		*plus = '\0';
+		if (!strcmp(key, "Shift")) b->mod |= ShiftMask;
+		else if (!strcmp(key, "Control") || !strcmp(key, "Ctrl")) b->mod |= ControlMask;
+		else if (!strcmp(key, "Mod1") || !strcmp(key, "Alt")) b->mod |= Mod1Mask;
+		else if (!strcmp(key, "Mod4") || !strcmp(key, "Super")) b->mod |= Mod4Mask;
+		else return 0;
+	}
+	b->keysym = XStringToKeysym(key);
+	if (b->keysym == NoSymbol) return 0;
+	strcpy(b->action, action);
+	b->arg = arg;
+	return 1;
+}
+
+/* "class role type action..." where actions are desktop=N, maximized and nofocus */
+static int parse_rule(const char *v, RuleSpec *r) {
+	char copy[256], *save, *tok;
+	char *fields[3] = { r->class, r->role, r->type };
+
+	if (strlen(v) >= sizeof(copy)) return 0;
+	strcpy(copy, v);
+	r->desktop = r->maximized = r->nofocus = -1;
+
+	tok = strtok_r(copy, " \t", &save);
+	for (int i = 0; i < 3; i++, tok = strtok_r(NULL, " \t", &save)) {
+		if (!tok || strlen(tok) >= RULE_FIELD_LEN) return 0;
+		strcpy(fields[i], tok);
+	}
+	if (!tok) return 0;
+	for (; tok; tok = strtok_r(NULL, " \t", &save)) {
+		if (!strncmp(tok, "desktop=", 8)) {
+			if (!parse_int(tok + 8, 1, NUM_DESKTOPS, &r->desktop)) return 0;
+			r->desktop--;
+		} else if (!strcmp(tok, "maximized")) {
+			r->maximized = 1;
+		} else if (!strcmp(tok, "nofocus")) {
+			r->nofocus = 1;
+		} else {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Store one key = value pair; returns 0 if the value is unusable */
+static int settings_set(Settings *s, const char *key, const char *value) {
+	if (!strcmp(key, "border_width")) return parse_int(value, 0, 32, &s->border_width);
+	if (!strcmp(key, "bar_height")) return parse_int(value, 0, 200, &s->bar_height);
+	if (!strcmp(key, "update_interval")) return parse_int(value, 1, 3600, &s->update_interval);
+	if (!strcmp(key, "lock_blur")) return parse_int(value, 0, 1, &s->lock_blur);
+	if (!strcmp(key, "border_color")) return parse_color(value, &s->border_color);
+	if (!strcmp(key, "border_color_inactive")) return parse_color(value, &s->border_color_inactive);
+	if (!strcmp(key, "bar_background")) return parse_color(value, &s->bar_background);
+	if (!strcmp(key, "bar_foreground")) return parse_color(value, &s->bar_foreground);
+	if (!strcmp(key, "font")) {
+		if (!*value || strlen(value) >= SETTINGS_FONT_LEN) return 0;
+		strcpy(s->font, value);
+		return 1;
+	}
+	if (!strcmp(key, "rule")) {
+		if (s->nrules >= SETTINGS_MAX_RULES) return 0;
+		if (!parse_rule(value, &s->rules[s->nrules])) return 0;
+		s->nrules++;
+		return 1;
+	}
+	if (!strcmp(key, "bind")) {
+		if (s->nbindings >= SETTINGS_MAX_BINDINGS) return 0;
+		if (!parse_binding(value, &s->bindings[s->nbindings])) return 0;
+		s->nbindings++;
+		return 1;
+	}
+	return 0;
+}
+
+/* Single pass over the file: each line is "key = value", lines starting with
+ * '#' are comments. Keys and values are terminated in place, so nothing is
+ * copied or rescanned. */
+static void settings_parse(Settings *s, char *buf, size_t len) {
+	char *p = buf, *end = buf + len;
+
+	for (int line = 1; p < end; line++) {
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		char *key = p;
+		if (p < end && *p == '#') key = end;
+		while (p < end && *p != '=' && *p != '\n' && *p != ' ' && *p != '\t') p++;
+		char *key_end = p;
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+		char *value = NULL, *value_end = NULL;
+		if (p < end && *p == '=') {
+			for (p++; p < end && (*p == ' ' || *p == '\t'); p++);
+			value = p;
+			for (; p < end && *p != '\n'; p++) {
+				if (*p != ' ' && *p != '\t' && *p != '\r') value_end = p + 1;
+			}
+		}
+		while (p < end && *p != '\n') p++;
+
+		if (key_end > key) {
+			*key_end = '\0';
+			if (value_end) *value_end = '\0';
+			if (!value || !settings_set(s, key, value_end ? value : "")) {
+				fprintf(stderr, "swm: %s:%d: ignoring bad setting '%s'\n", path, line, key);
+			}
+		}
+		p++;
+	}
+}
+
+/* Fill a snapshot from the file; a missing file gives the defaults */
+static void settings_load(Settings *s) {
+	settings_defaults(s);
+
+	FILE *f = fopen(path, "r");
+	if (!f) return;
+	char *buf = malloc(SETTINGS_MAX_FILE + 1);
+	if (buf) {
+		size_t len = fread(buf, 1, SETTINGS_MAX_FILE, f);
+		buf[len] = '\0';
+		settings_parse(s, buf, len);
+		free(buf);
+	}
+	fclose(f);
+}
+
+static int settings_diff(const Settings *a, const Settings *b) {
+	int changed = 0;
+
+	if (a->border_width != b->border_width || a->border_color != b->border_color ||
+			a->border_color_inactive != b->border_color_inactive) {
+		changed |= SETTINGS_BORDER;
+	}
+	if (a->bar_height != b->bar_height || a->update_interval != b->update_interval ||
+			a->bar_background != b->bar_background || a->bar_foreground != b->bar_foreground) {
+		changed |= SETTINGS_BAR;
+	}
+	if (strcmp(a->font, b->font)) changed |= SETTINGS_FONT;
+	if (a->nbindings != b->nbindings ||
+			memcmp(a->bindings, b->bindings, a->nbindings * sizeof(Binding))) {
+		changed |= SETTINGS_KEYS;
+	}
+	if (a->nrules != b->nrules || memcmp(a->rules, b->rules, a->nrules * sizeof(RuleSpec))) {
+		changed |= SETTINGS_RULES;
+	}
+	if (a->lock_blur != b->lock_blur) changed |= SETTINGS_LOCK;
+	return changed;
+}
+
+/* Publish a fresh snapshot and let swm re-apply what differs. The status bar
+ * thread may still be drawing from the old one, so it lives one more reload. */
+static void settings_reload() {
+	Settings *s = malloc(sizeof(Settings));
+	if (!s) return;
+	settings_load(s);
+
+	Settings *old = atomic_load(&current);
+	int changed = settings_diff(old, s);
+	if (!changed) {
+		free(s);
+		return;
+	}
+	s->generation = old->generation + 1;
+	if (retired != &initial) free(retired);
+	retired = old;
+	atomic_store(&current, s);
+	apply_fn(old, s, changed);
+}
+
+/* Watch the config directory, or its parent until the directory is created */
+static int settings_watch() {
+	/* Editors save by rename as often as in place */
+	dir_wd = inotify_add_watch(inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+	if (dir_wd >= 0) {
+		if (parent_wd >= 0) inotify_rm_watch(inotify_fd, parent_wd);
+		parent_wd = -1;
+		return 1;
+	}
+	if (parent_wd >= 0) return 0;
+
+	char parent[sizeof(dir)];
+	strcpy(parent, dir);
+	char *slash = strrchr(parent, '/');
+	if (!slash) return 0;
+	*slash = '\0';
+	parent_wd = inotify_add_watch(inotify_fd, *parent ? parent : "/", IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+	return 0;
+}
+
+static void settings_inotify(int fd, void *arg) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const char *base = strrchr(dir, '/') + 1;
+	ssize_t len;
+	int reload = 0;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + len; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			if (ev->wd == dir_wd) {
+				if (ev->mask & IN_IGNORED) {
+					/* Directory removed: wait for it to come back */
+					dir_wd = -1;
+					settings_watch();
+					reload = 1;
+				} else if (ev->len && !strcmp(ev->name, "config")) {
+					reload = 1;
+				}
+			} else if (ev->wd == parent_wd && ev->len && !strcmp(ev->name, base)) {
+				/* The file may already be in place if it was moved in */
+				if (settings_watch()) reload = 1;
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	if (reload) settings_reload();
+}
+
+/* Load $XDG_CONFIG_HOME/swm/config and watch its directory for edits */
+void settings_init(settings_apply_fn apply) {
+	const char *xdg = getenv("XDG_CONFIG_HOME");
+	const char *home = getenv("HOME");
+
+	apply_fn = apply;
+	if (xdg && *xdg) {
+		snprintf(dir, sizeof(dir), "%s/swm", xdg);
+	} else {
+		snprintf(dir, sizeof(dir), "%s/.config/swm", home ? home : ".");
+	}
+	snprintf(path, sizeof(path), "%s/config", dir);
+	settings_load(&initial);
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) return;
+	if (settings_watch() || parent_wd >= 0) {
+		evloop_add_fd(inotify_fd, settings_inotify, NULL);
+	} else {
+		close(inotify_fd);
+		inotify_fd = -1;
+	}
+}
+
+const Settings *settings_get() {
+	return atomic_load(&current);
+}
+
+/* Allocate a 0xRRGGBB color in the default colormap */
+unsigned long settings_pixel(Display *display, int screen, unsigned long rgb) {
+	XColor c;
+	c.red = ((rgb >> 16) & 0xFF) * 257;
+	c.green = ((rgb >> 8) & 0xFF) * 257;
+	c.blue = (rgb & 0xFF) * 257;
+	c.flags = DoRed | DoGreen | DoBlue;
+	if (!XAllocColor(display, DefaultColormap(display, screen), &c)) return BlackPixel(display, screen);
+	return c.pixel;
+}
+
+/* Call once the status bar thread has stopped reading snapshots */
+void settings_free() {
+	if (inotify_fd >= 0) {
+		evloop_remove_fd(inotify_fd);
+		close(inotify_fd);
+		inotify_fd = -1;
+		dir_wd = parent_wd = -1;
+	}
+	Settings *s = atomic_exchange(&current, &initial);
+	if (s != &initial) free(s);
+	if (retired != &initial) free(retired);
+	retired = NULL;
+}
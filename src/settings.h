@@ -0,0 +1,63 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <X11/Xlib.h>
+
+#define SETTINGS_MAX_BINDINGS 64
+#define SETTINGS_MAX_FILE 65536
+#define SETTINGS_FONT_LEN 128
+#define SETTINGS_ACTION_LEN 32
+#define SETTINGS_MAX_RULES 512
+#define RULE_FIELD_LEN 64
+
+/* What changed between two snapshots, so a reload only touches those parts */
+#define SETTINGS_BORDER (1 << 0)
+#define SETTINGS_BAR (1 << 1)
+#define SETTINGS_FONT (1 << 2)
+#define SETTINGS_KEYS (1 << 3)
+#define SETTINGS_RULES (1 << 4)
+#define SETTINGS_LOCK (1 << 5)
+
+/* Key binding from the config file, resolved against swm's actions when grabbed */
+typedef struct {
+	unsigned int mod;
+	KeySym keysym;
+	char action[SETTINGS_ACTION_LEN];
+	int arg;
+} Binding;
+
+/* Window rule as written: "*" matches anything; -1 leaves a setting alone */
+typedef struct {
+	char class[RULE_FIELD_LEN];
+	char role[RULE_FIELD_LEN];
+	char type[RULE_FIELD_LEN];
+	int desktop;
+	int maximized;
+	int nofocus;
+} RuleSpec;
+
+/* One parsed configuration. Published snapshots are never modified; a reload
+ * builds a new one and swaps the pointer. Colors are 0xRRGGBB. */
+typedef struct {
+	unsigned long generation;  /* Bumped on every reload */
+	int border_width;
+	int bar_height;
+	int update_interval;
+	int lock_blur;
+	char font[SETTINGS_FONT_LEN];
+	unsigned long border_color, border_color_inactive;
+	unsigned long bar_background, bar_foreground;
+	int nbindings;
+	Binding bindings[SETTINGS_MAX_BINDINGS];
+	int nrules;
+	RuleSpec rules[SETTINGS_MAX_RULES];
+} Settings;
+
+typedef void (*settings_apply_fn)(const Settings *old, const Settings *cur, int changed);
+
+void settings_init(settings_apply_fn apply);
+const Settings *settings_get();
+unsigned long settings_pixel(Display *display, int screen, unsigned long rgb);
+void settings_free();
+
+#endif /* SETTINGS_H */
@@ -1,49 +1,76 @@
 #include <X11/Xlib.h>
 #include "main.h"
 #include "status.h"
+#include "monitor.h"
+#include "settings.h"
+#include "redraw.h"
+#include "trace.h"
 #include <pthread.h>
 
 static StatusBar status_bar;
 static pthread_t status_thread;
 static volatile int status_running = 1;  // Made volatile for proper visibility
+static int status_started = 0;  // status_thread exists and must be joined
 static pthread_mutex_t status_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t focused_mutex = PTHREAD_MUTEX_INITIALIZER;  // Protect focused access
-static WindowNode *focused = NULL; // For displaying title
 
-/* Function to safely get window title */
-static void get_window_title_safe(char *buffer, size_t buffer_size) {
-    pthread_mutex_lock(&focused_mutex);
+// Settings the bar was last drawn with
+static unsigned long applied_generation = (unsigned long)-1;
+static unsigned long bar_background, bar_foreground;
+static int bar_height = BAR_HEIGHT;
+static char font_name[SETTINGS_FONT_LEN];
 
-    focused = current_window;
-    if (focused && focused->window) {
-        char *window_title;
-        if (XFetchName(status_bar.display, focused->window, &window_title) == Success && window_title) {
-            strncpy(buffer, window_title, buffer_size - 1);
-            buffer[buffer_size - 1] = '\0';  // Ensure null termination
-            XFree(window_title);
-        } else {
-            buffer[0] = '\0';
-        }
+/* Title of the focused window, from the frame's cache rather than the server */
+static void get_window_title(char *buffer, size_t buffer_size) {
+    if (current_window) {
+        strncpy(buffer, current_window->title, buffer_size - 1);
+        buffer[buffer_size - 1] = '\0';
     } else {
         buffer[0] = '\0';
     }
+}
+
+/* Take over colors, font and height from a new settings snapshot */
+static void apply_settings(const Settings *cfg, Monitor *mons, int nmon) {
+    Display *dpy = status_bar.display;
+    
+    applied_generation = cfg->generation;
+    bar_background = settings_pixel(dpy, status_bar.screen, cfg->bar_background);
+    bar_foreground = settings_pixel(dpy, status_bar.screen, cfg->bar_foreground);
+    
+    if (!status_bar.font || strcmp(font_name, cfg->font)) {
+        XFontStruct *font = XLoadQueryFont(dpy, cfg->font);
+        if (font) {
+            if (status_bar.font) XFreeFont(dpy, status_bar.font);
+            status_bar.font = font;
+            strcpy(font_name, cfg->font);
+            XSetFont(dpy, status_bar.gc, font->fid);
+        }
+    }
     
-    pthread_mutex_unlock(&focused_mutex);
+    // Uncover the strip a taller bar used to occupy
+    for (int i = 0; i < nmon && bar_height > cfg->bar_height; i++) {
+        XClearArea(dpy, status_bar.root, mons[i].x, mons[i].y + mons[i].height - bar_height,
+                   mons[i].width, bar_height - cfg->bar_height, False);
+    }
+    bar_height = cfg->bar_height;
 }
 
-/* Function to draw the status bar */
-void draw_status_bar() {
-    char window_title_local[128];  // Local copy to avoid race conditions
+/* Draw the status bar; runs on the main thread from the redraw scheduler */
+static void draw_status_bar(void *arg) {
+    char window_title_local[128];
     
-    // Get window title safely
-    get_window_title_safe(window_title_local, sizeof(window_title_local));
+    TRACE_BEGIN("draw_status_bar");
+    get_window_title(window_title_local, sizeof(window_title_local));
     
-    // X11 operations with display locking
-    XLockDisplay(status_bar.display);
+    // Monitor geometry comes from the cache, not the server
+    Monitor mons[MAX_MONITORS];
+    int nmon = monitor_snapshot(mons, MAX_MONITORS);
     
-    int screen_width = XDisplayWidth(status_bar.display, status_bar.screen);
-    int screen_height = XDisplayHeight(status_bar.display, status_bar.screen);
-    int bar_y = screen_height - BAR_HEIGHT;
+    // Snapshots are immutable, so one read covers the whole redraw
+    const Settings *cfg = settings_get();
+    if (cfg->generation != applied_generation) {
+        apply_settings(cfg, mons, nmon);
+    }
     
     // Get time
     char time_buffer[64];
@@ -55,43 +82,50 @@ void draw_status_bar() {
     int title_width = XTextWidth(status_bar.font, window_title_local, strlen(window_title_local));
     int time_width = XTextWidth(status_bar.font, time_buffer, strlen(time_buffer));
     
-    // Clear status bar
-    XSetForeground(status_bar.display, status_bar.gc, BlackPixel(status_bar.display, status_bar.screen));
-    XFillRectangle(status_bar.display, status_bar.root, status_bar.gc, 0, bar_y, screen_width, BAR_HEIGHT);
-    
-    // Draw title (centered)
-    int title_x = (screen_width - title_width) / 2;
-    int title_y = bar_y + (BAR_HEIGHT + status_bar.font->ascent) / 2;
-    XSetForeground(status_bar.display, status_bar.gc, WhitePixel(status_bar.display, status_bar.screen));
-    XDrawString(status_bar.display, status_bar.root, status_bar.gc, title_x, title_y, 
-                window_title_local, strlen(window_title_local));
-    
-    // Draw time (right-aligned)
-    int time_x = screen_width - time_width - 10; // 10px padding from right
-    XDrawString(status_bar.display, status_bar.root, status_bar.gc, time_x, title_y, 
-                time_buffer, strlen(time_buffer));
-    
-    // Flush changes
-    XFlush(status_bar.display);
-    XUnlockDisplay(status_bar.display);
+    // Draw one bar along the bottom of every output
+    for (int i = 0; i < nmon; i++) {
+        int bar_x = mons[i].x;
+        int bar_y = mons[i].y + mons[i].height - bar_height;
+        int bar_width = mons[i].width;
+        
+        // Clear status bar
+        XSetForeground(status_bar.display, status_bar.gc, bar_background);
+        XFillRectangle(status_bar.display, status_bar.root, status_bar.gc, bar_x, bar_y, bar_width, bar_height);
+        
+        // Draw title (centered)
+        int title_x = bar_x + (bar_width - title_width) / 2;
+        int title_y = bar_y + (bar_height + status_bar.font->ascent) / 2;
+        XSetForeground(status_bar.display, status_bar.gc, bar_foreground);
+        XDrawString(status_bar.display, status_bar.root, status_bar.gc, title_x, title_y, 
+                    window_title_local, strlen(window_title_local));
+        
+        // Draw time (right-aligned)
+        int time_x = bar_x + bar_width - time_width - 10; // 10px padding from right
+        XDrawString(status_bar.display, status_bar.root, status_bar.gc, time_x, title_y, 
+                    time_buffer, strlen(time_buffer));
+    }
+    TRACE_END("draw_status_bar");
 }
 
-/* Function to continuously show the status bar */
+/* Redraw on the next frame, e.g. because the focused window or its title changed */
+void status_invalidate() {
+    redraw_mark(draw_status_bar, NULL);
+}
+
+/* Tick the clock: the thread only asks for a redraw, drawing is left to the main loop */
 void *status_loop(void *p) {
     (void)p;
+    trace_thread_name("status");
     
     while (status_running) {  // volatile ensures proper visibility
-        draw_status_bar();
-        
-        // Use nanosleep instead of sleep for better interruption handling
-        struct timespec sleep_time = {UPDATE_INTERVAL, 0};
-        nanosleep(&sleep_time, NULL);
+        TRACE_BEGIN("status_tick");
+        redraw_mark_async(draw_status_bar, NULL);
+        TRACE_END("status_tick");
         
-        // Check status_running more frequently if UPDATE_INTERVAL is large
-        if (UPDATE_INTERVAL > 1) {
-            for (int i = 0; i < UPDATE_INTERVAL && status_running; i++) {
-                sleep(1);
-            }
+        // Sleep in one second steps so status_free() never waits long
+        int interval = settings_get()->update_interval;
+        for (int i = 0; i < interval && status_running; i++) {
+            sleep(1);
         }
     }
     
@@ -114,11 +148,13 @@ int status_init(Display *display, int screen) {
     status_bar.root = RootWindow(status_bar.display, status_bar.screen);
     status_bar.gc = XCreateGC(status_bar.display, status_bar.root, 0, NULL);
     
-    // Load font
+    // Load font; the configured one replaces it on the first redraw
     status_bar.font = XLoadQueryFont(status_bar.display, "fixed");
+    strcpy(font_name, "fixed");
     if (!status_bar.font) {
         fprintf(stderr, "Failed to load font\n");
         XFreeGC(status_bar.display, status_bar.gc);
+        status_bar.gc = NULL;
         pthread_mutex_unlock(&status_mutex);
         return 1;
     }
@@ -133,9 +169,12 @@ int status_init(Display *display, int screen) {
         fprintf(stderr, "Failed to create status bar thread\n");
         XFreeFont(status_bar.display, status_bar.font);
         XFreeGC(status_bar.display, status_bar.gc);
+        status_bar.font = NULL;
+        status_bar.gc = NULL;
         pthread_mutex_unlock(&status_mutex);
         return 1;
     }
+    status_started = 1;
     
     pthread_mutex_unlock(&status_mutex);
     return 0;
@@ -150,9 +189,11 @@ void status_free() {
     
     pthread_mutex_unlock(&status_mutex);
     
-    // Wait for thread to finish
-    pthread_join(status_thread, NULL);
-    // Remove the invalid pthread_wait() call
+    // Wait for thread to finish; cleanup() also runs when startup failed before it was created
+    if (status_started) {
+        pthread_join(status_thread, NULL);
+        status_started = 0;
+    }
     
     pthread_mutex_lock(&status_mutex);
     
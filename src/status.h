@@ -24,6 +24,7 @@ typedef struct {
 
 /* Function prototypes */
 int status_init(Display *display, int screen);
+void status_invalidate();
 void status_free();
 
 #endif /* STATUS_H */
@@ -0,0 +1,304 @@
+#include <string.h>
+#include <X11/keysym.h>
+#include "switcher.h"
+#include <X11/extensions/Xrender.h>
+#include "compositor.h"
+#include "evloop.h"
+#include "monitor.h"
+#include "trace.h"
+
+static Display *dpy;
+static Window root, win = None;
+static int scr;
+static GC gc;
+static XFontStruct *font;
+static XRenderPictFormat *format;
+static WindowNode **windows;
+static switcher_focus_fn focus_fn;
+static Pixmap buffer = None;
+static int width, height;
+static unsigned long highlight;
+static int refresh_timer = 0;
+static XModifierKeymap *modmap;  /* Keycodes behind each modifier bit */
+static unsigned int hold;  /* Modifiers of the binding that opened the switcher */
+
+/* Entries of the open switcher, in cycling order */
+static WindowNode *entries[MAX_WINDOWS];
+static int count = 0, selected = 0, shown = 0;
+static int columns, rows, first_row;
+
+int switcher_init(Display *display, int screen, WindowNode **list, switcher_focus_fn focus) {
+	XSetWindowAttributes wa;
+	XColor c;
+
+	dpy = display;
+	scr = screen;
+	root = RootWindow(dpy, scr);
+	windows = list;
+	focus_fn = focus;
+	format = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, scr));
+
+	font = XLoadQueryFont(dpy, "fixed");
+	if (!font) return 0;
+	gc = XCreateGC(dpy, root, 0, NULL);
+	XSetFont(dpy, gc, font->fid);
+
+	c.red = 0x3A * 257;
+	c.green = 0x6E * 257;
+	c.blue = 0xA5 * 257;
+	c.flags = DoRed | DoGreen | DoBlue;
+	highlight = XAllocColor(dpy, DefaultColormap(dpy, scr), &c) ? c.pixel : WhitePixel(dpy, scr);
+
+	/* Drawn from a back buffer, so the server never clears it */
+	wa.override_redirect = True;
+	wa.background_pixmap = None;
+	wa.border_pixel = WhitePixel(dpy, scr);
+	win = XCreateWindow(dpy, root, 0, 0, 1, 1, 1, CopyFromParent, InputOutput, CopyFromParent,
+		CWOverrideRedirect | CWBackPixmap | CWBorderPixel, &wa);
+	XSelectInput(dpy, win, ExposureMask);
+	modmap = XGetModifierMapping(dpy);
+	return 1;
+}
+
+/* Call on MappingNotify for modifiers, so releases are matched to the new keys */
+void switcher_refresh_modifiers() {
+	if (modmap) XFreeModifiermap(modmap);
+	modmap = XGetModifierMapping(dpy);
+}
+
+/* Whether the key is one of those behind the modifiers being held */
+static int releases_hold(unsigned int keycode) {
+	if (!modmap) return 0;
+	for (int m = 0; m < 8; m++) {
+		if (!(hold & (1u << m))) continue;
+		for (int i = 0; i < modmap->max_keypermod; i++) {
+			if (modmap->modifiermap[m * modmap->max_keypermod + i] == keycode) return 1;
+		}
+	}
+	return 0;
+}
+
+/* Downscale the frame's current contents into its cached thumbnail.
+ * Compositing gives the off-screen pixmap; otherwise the frame must be on screen. */
+void switcher_capture(WindowNode *node) {
+	XRenderPictureAttributes pa;
+
+	if (!node->frame || node->gwidth < 1 || node->gheight < 1) return;
+
+	/* Fit the frame into the thumbnail box, keeping its aspect */
+	int tw = THUMB_WIDTH, th = node->gheight * THUMB_WIDTH / node->gwidth;
+	if (th > THUMB_HEIGHT) {
+		th = THUMB_HEIGHT;
+		tw = node->gwidth * THUMB_HEIGHT / node->gheight;
+	}
+	if (tw < 1) tw = 1;
+	if (th < 1) th = 1;
+
+	if (node->thumb && (node->thumb_width != tw || node->thumb_height != th)) {
+		XFreePixmap(dpy, node->thumb);
+		node->thumb = None;
+	}
+	if (!node->thumb) {
+		node->thumb = XCreatePixmap(dpy, root, tw, th, DefaultDepth(dpy, scr));
+		node->thumb_width = tw;
+		node->thumb_height = th;
+	}
+
+	Pixmap named = compositor_window_pixmap(node->frame);
+	pa.subwindow_mode = IncludeInferiors;
+	Picture src = XRenderCreatePicture(dpy, named ? named : node->frame, format, CPSubwindowMode, &pa);
+	Picture dst = XRenderCreatePicture(dpy, node->thumb, format, 0, NULL);
+
+	/* The transform maps thumbnail pixels back onto the frame */
+	XTransform scale = {{
+		{ XDoubleToFixed((double)node->gwidth / tw), 0, 0 },
+		{ 0, XDoubleToFixed((double)node->gheight / th), 0 },
+		{ 0, 0, XDoubleToFixed(1) },
+	}};
+	XRenderSetPictureTransform(dpy, src, &scale);
+	XRenderSetPictureFilter(dpy, src, FilterBilinear, NULL, 0);
+	XRenderComposite(dpy, PictOpSrc, src, None, dst, 0, 0, 0, 0, 0, 0, tw, th);
+
+	XRenderFreePicture(dpy, src);
+	XRenderFreePicture(dpy, dst);
+	node->thumb_dirty = 0;
+}
+
+static void draw();
+
+/* Recapture damaged windows that have an off-screen pixmap to read from */
+static void refresh(void *arg) {
+	refresh_timer = 0;
+	for (WindowNode *node = *windows; node; node = node->next) {
+		if (node->thumb_dirty && compositor_window_pixmap(node->frame)) switcher_capture(node);
+	}
+	if (shown) draw();
+}
+
+/* Called on damage; recaptures are batched so a busy client costs one downscale per refresh */
+void switcher_invalidate(WindowNode *node) {
+	node->thumb_dirty = 1;
+	if (!refresh_timer) refresh_timer = evloop_add_timer(THUMB_REFRESH_US, refresh, NULL);
+}
+
+static void hide() {
+	XUngrabKeyboard(dpy, CurrentTime);
+	XUnmapWindow(dpy, win);
+	shown = 0;
+}
+
+void switcher_forget(WindowNode *node) {
+	if (node->thumb) XFreePixmap(dpy, node->thumb);
+	node->thumb = None;
+
+	for (int i = 0; shown && i < count; i++) {
+		if (entries[i] != node) continue;
+		memmove(&entries[i], &entries[i + 1], (count - i - 1) * sizeof(WindowNode *));
+		count--;
+		if (selected > i || selected == count) selected = selected > 0 ? selected - 1 : 0;
+		if (count == 0) hide();
+		else draw();
+		break;
+	}
+}
+
+/* Render every visible cell into the back buffer, then present it in one copy */
+static void draw() {
+	int cell_w = THUMB_WIDTH + SWITCHER_PAD;
+	int cell_h = THUMB_HEIGHT + SWITCHER_LABEL + SWITCHER_PAD;
+	int max_chars = THUMB_WIDTH / font->max_bounds.width;
+
+	/* Scroll so the selection stays on screen */
+	int row = selected / columns;
+	if (row < first_row) first_row = row;
+	if (row >= first_row + rows) first_row = row - rows + 1;
+
+	XSetForeground(dpy, gc, BlackPixel(dpy, scr));
+	XFillRectangle(dpy, buffer, gc, 0, 0, width, height);
+
+	for (int i = first_row * columns; i < count && i < (first_row + rows) * columns; i++) {
+		WindowNode *node = entries[i];
+		int x = SWITCHER_PAD + (i % columns) * cell_w;
+		int y = SWITCHER_PAD + (i / columns - first_row) * cell_h;
+
+		if (i == selected) {
+			XSetForeground(dpy, gc, highlight);
+			XFillRectangle(dpy, buffer, gc, x - SWITCHER_PAD / 2, y - SWITCHER_PAD / 2,
+				cell_w, cell_h);
+		}
+
+		/* Windows never captured yet get an outline */
+		if (node->thumb) {
+			XCopyArea(dpy, node->thumb, buffer, gc, 0, 0, node->thumb_width, node->thumb_height,
+				x + (THUMB_WIDTH - node->thumb_width) / 2, y + (THUMB_HEIGHT - node->thumb_height) / 2);
+		} else {
+			XSetForeground(dpy, gc, WhitePixel(dpy, scr));
+			XDrawRectangle(dpy, buffer, gc, x, y, THUMB_WIDTH - 1, THUMB_HEIGHT - 1);
+		}
+
+		int len = strlen(node->title);
+		if (len > max_chars) len = max_chars;
+		XSetForeground(dpy, gc, WhitePixel(dpy, scr));
+		XDrawString(dpy, buffer, gc, x, y + THUMB_HEIGHT + font->ascent + 2, node->title, len);
+	}
+
+	XCopyArea(dpy, buffer, win, gc, 0, 0, width, height, 0, 0);
+}
+
+/* Open on the given windows; nothing is captured here, cached thumbnails are drawn as they are */
+int switcher_show(WindowNode **nodes, int n, int sel, unsigned int mods) {
+	Window root_return, child_return;
+	int rx, ry, wx, wy;
+	unsigned int mask;
+
+	if (shown || n < 1) return 0;
+	if (TRACE_X("XGrabKeyboard", XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime)) != GrabSuccess) {
+		return 0;
+	}
+
+	if (n > MAX_WINDOWS) n = MAX_WINDOWS;
+	memcpy(entries, nodes, n * sizeof(WindowNode *));
+	count = n;
+	selected = sel < n ? sel : 0;
+	first_row = 0;
+
+	/* As square a grid as fits the primary monitor */
+	Monitor mon = monitor_get(0);
+	int cell_w = THUMB_WIDTH + SWITCHER_PAD;
+	int cell_h = THUMB_HEIGHT + SWITCHER_LABEL + SWITCHER_PAD;
+	int max_columns = (mon.width - SWITCHER_PAD) / cell_w;
+	int max_rows = (mon.height - SWITCHER_PAD) / cell_h;
+	columns = 1;
+	while (columns * columns < n) columns++;
+	if (columns > max_columns) columns = max_columns > 0 ? max_columns : 1;
+	rows = (n + columns - 1) / columns;
+	if (rows > max_rows) rows = max_rows > 0 ? max_rows : 1;
+
+	int w = SWITCHER_PAD + columns * cell_w, h = SWITCHER_PAD + rows * cell_h;
+	if (!buffer || w != width || h != height) {
+		if (buffer) XFreePixmap(dpy, buffer);
+		buffer = XCreatePixmap(dpy, win, w, h, DefaultDepth(dpy, scr));
+		width = w;
+		height = h;
+	}
+	XMoveResizeWindow(dpy, win, mon.x + (mon.width - w) / 2, mon.y + (mon.height - h) / 2, w, h);
+	draw();
+	XMapRaised(dpy, win);
+	shown = 1;
+
+	/* The modifiers may have been let go before the grab took effect */
+	hold = mods;
+	TRACE_X("XQueryPointer", XQueryPointer(dpy, root, &root_return, &child_return, &rx, &ry, &wx, &wy, &mask));
+	if ((mask & hold) != hold) {
+		hide();
+		focus_fn(entries[selected]);
+	}
+	return 1;
+}
+
+/* While open the switcher owns the keyboard: Tab cycles, releasing a held modifier picks */
+int switcher_handle_event(XEvent *ev) {
+	if (!shown) return 0;
+
+	switch (ev->type) {
+		case KeyPress: {
+			KeySym key = XLookupKeysym(&ev->xkey, 0);
+			if (key == XK_Tab) {
+				selected = (selected + ((ev->xkey.state & ShiftMask) ? count - 1 : 1)) % count;
+				draw();
+			} else if (key == XK_Escape) {
+				hide();
+			} else if (key == XK_Return) {
+				hide();
+				focus_fn(entries[selected]);
+			}
+			return 1;
+		}
+		case KeyRelease:
+			if (releases_hold(ev->xkey.keycode)) {
+				hide();
+				focus_fn(entries[selected]);
+			}
+			return 1;
+		case Expose:
+			if (ev->xexpose.window != win) return 0;
+			if (ev->xexpose.count == 0) XCopyArea(dpy, buffer, win, gc, 0, 0, width, height, 0, 0);
+			return 1;
+	}
+	return 0;
+}
+
+void switcher_free() {
+	if (refresh_timer) evloop_cancel_timer(refresh_timer);
+	refresh_timer = 0;
+	if (!dpy || win == None) return;
+	if (shown) hide();
+	if (buffer) XFreePixmap(dpy, buffer);
+	buffer = None;
+	XDestroyWindow(dpy, win);
+	win = None;
+	XFreeGC(dpy, gc);
+	XFreeFont(dpy, font);
+	if (modmap) XFreeModifiermap(modmap);
+	modmap = NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef SWITCHER_H
+#define SWITCHER_H
+
+#include <X11/Xlib.h>
+#include "main.h"
+
+#define THUMB_WIDTH 160
+#define THUMB_HEIGHT 120
+#define THUMB_REFRESH_US 250000
+#define SWITCHER_PAD 8
+#define SWITCHER_LABEL 16
+
+typedef void (*switcher_focus_fn)(WindowNode *node);
+
+int switcher_init(Display *display, int screen, WindowNode **list, switcher_focus_fn focus);
+void switcher_capture(WindowNode *node);
+void switcher_invalidate(WindowNode *node);
+void switcher_forget(WindowNode *node);
+void switcher_refresh_modifiers();
+int switcher_show(WindowNode **nodes, int n, int selected, unsigned int mods);
+int switcher_handle_event(XEvent *ev);
+void switcher_free();
+
+#endif /* SWITCHER_H */
@@ -0,0 +1,162 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "util.h"
+
+/* Scripted client workload for profiling swm under Xvfb: window churn,
+ * window switching and title updates the status bar picks up on its ticks.
+ * With -d it instead fills two desktops and times switching between them. */
+
+#define LOAD_WINDOWS 12
+#define LOAD_ITERATIONS 200
+#define LOAD_SWITCHES 8
+#define LOAD_DELAY_US 20000
+#define LOAD_DESKTOP_WINDOWS 120
+#define LOAD_DESKTOP_SWITCHES 50
+
+static Display *dpy;
+static Window root;
+
+/* Deliver a key press or release to the window manager as a synthetic event on the root */
+static void send_key(int type, KeySym sym, unsigned int state) {
+	XKeyEvent ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = type;
+	ev.display = dpy;
+	ev.window = root;
+	ev.root = root;
+	ev.subwindow = None;
+	ev.time = CurrentTime;
+	ev.same_screen = True;
+	ev.state = state;
+	ev.keycode = XKeysymToKeycode(dpy, sym);
+	XSendEvent(dpy, root, False, type == KeyPress ? KeyPressMask : KeyReleaseMask, (XEvent *)&ev);
+}
+
+static Window create_client(int i) {
+	char title[32];
+	Window win = XCreateSimpleWindow(dpy, root, 20 * i, 20 * i, 320 + 10 * i, 240,
+		1, BlackPixel(dpy, DefaultScreen(dpy)), WhitePixel(dpy, DefaultScreen(dpy)));
+	snprintf(title, sizeof(title), "swmload %d", i);
+	XStoreName(dpy, win, title);
+	XMapWindow(dpy, win);
+	return win;
+}
+
+static void pause_us(long us) {
+	struct timespec ts = { us / 1000000L, (us % 1000000L) * 1000L };
+	nanosleep(&ts, NULL);
+}
+
+/* Ask the window manager for a desktop and wait until it reports the switch */
+static long switch_desktop(Atom current, int desktop) {
+	XEvent ev;
+	struct timespec start;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.xclient.type = ClientMessage;
+	ev.xclient.window = root;
+	ev.xclient.message_type = current;
+	ev.xclient.format = 32;
+	ev.xclient.data.l[0] = desktop;
+	ev.xclient.data.l[1] = CurrentTime;
+
+	timer_start(&start);
+	XSendEvent(dpy, root, False, SubstructureNotifyMask | SubstructureRedirectMask, &ev);
+	do {
+		XNextEvent(dpy, &ev);
+	} while (ev.type != PropertyNotify || ev.xproperty.atom != current);
+	return timer_elapsed_us(&start);
+}
+
+/* Two desktops of windows; report switch latency as seen by a client */
+static int desktops(int windows, int switches) {
+	Atom current = XInternAtom(dpy, "_NET_CURRENT_DESKTOP", False);
+	long total = 0, worst = 0;
+
+	XSelectInput(dpy, root, PropertyChangeMask);
+	for (int d = 0; d < 2; d++) {
+		if (d > 0) switch_desktop(current, d);
+		for (int i = 0; i < windows; i++) {
+			create_client(i % LOAD_WINDOWS);
+		}
+		XSync(dpy, False);
+		pause_us(500000);
+	}
+
+	for (int n = 0; n < switches; n++) {
+		long us = switch_desktop(current, n % 2);
+		total += us;
+		if (us > worst) worst = us;
+		pause_us(LOAD_DELAY_US);
+	}
+	fprintf(stderr, "swmload: %d switches with %d windows per desktop: avg %ld us, max %ld us\n",
+		switches, windows, total / switches, worst);
+
+	XCloseDisplay(dpy);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : LOAD_ITERATIONS;
+	Window windows[LOAD_WINDOWS];
+	struct timespec start;
+
+	dpy = XOpenDisplay(NULL);
+	if (!dpy) {
+		fprintf(stderr, "Cannot open display\n");
+		return 1;
+	}
+	root = DefaultRootWindow(dpy);
+
+	if (argc > 1 && !strcmp(argv[1], "-d")) {
+		return desktops(argc > 2 ? atoi(argv[2]) : LOAD_DESKTOP_WINDOWS,
+			argc > 3 ? atoi(argv[3]) : LOAD_DESKTOP_SWITCHES);
+	}
+
+	timer_start(&start);
+	for (int i = 0; i < LOAD_WINDOWS; i++) {
+		windows[i] = create_client(i);
+	}
+	XSync(dpy, False);
+
+	for (int n = 0; n < iterations; n++) {
+		/* Cycle the switcher, let go of Alt to pick, and toggle maximize on the pick */
+		for (int i = 0; i < LOAD_SWITCHES; i++) {
+			send_key(KeyPress, XK_Tab, Mod1Mask);
+		}
+		send_key(KeyRelease, XK_Alt_L, Mod1Mask);
+		send_key(KeyPress, XK_m, Mod4Mask);
+		send_key(KeyPress, XK_m, Mod4Mask);
+
+		/* Clients resizing and retitling themselves */
+		for (int i = 0; i < LOAD_WINDOWS; i++) {
+			char title[32];
+			XMoveResizeWindow(dpy, windows[i], 20 * i + n % 50, 20 * i, 320 + n % 100, 240 + i);
+			snprintf(title, sizeof(title), "swmload %d/%d", i, n);
+			XStoreName(dpy, windows[i], title);
+		}
+
+		/* Replace one client per iteration: unmap, destroy, map a new one */
+		int victim = n % LOAD_WINDOWS;
+		XUnmapWindow(dpy, windows[victim]);
+		XDestroyWindow(dpy, windows[victim]);
+		windows[victim] = create_client(victim);
+
+		XSync(dpy, False);
+		pause_us(LOAD_DELAY_US);
+	}
+
+	for (int i = 0; i < LOAD_WINDOWS; i++) {
+		XDestroyWindow(dpy, windows[i]);
+	}
+	XSync(dpy, False);
+	fprintf(stderr, "swmload: %d iterations in %ld ms\n", iterations, timer_elapsed_us(&start) / 1000);
+
+	XCloseDisplay(dpy);
+	return 0;
+}
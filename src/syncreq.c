@@ -0,0 +1,145 @@
+#include "syncreq.h"
+#include <X11/Xatom.h>
+#include <X11/extensions/sync.h>
+#include "evloop.h"
+#include "trace.h"
+
+static Display *dpy;
+static int sync_event_base = -1;
+static syncreq_ready_fn ready_fn;
+static Atom wm_protocols, net_wm_sync_request, net_wm_sync_request_counter;
+
+/* Set up XSync; without the extension every client is resized unpaced */
+int syncreq_init(Display *display, syncreq_ready_fn ready) {
+	int error_base, major, minor;
+
+	dpy = display;
+	ready_fn = ready;
+	wm_protocols = XInternAtom(dpy, "WM_PROTOCOLS", False);
+	net_wm_sync_request = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST", False);
+	net_wm_sync_request_counter = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST_COUNTER", False);
+
+	if (!XSyncQueryExtension(dpy, &sync_event_base, &error_base) ||
+			!XSyncInitialize(dpy, &major, &minor)) {
+		sync_event_base = -1;
+		return 0;
+	}
+	return 1;
+}
+
+/* Atom to list in _NET_SUPPORTED */
+Atom syncreq_atom() {
+	return net_wm_sync_request;
+}
+
+/* Whether a client lists _NET_WM_SYNC_REQUEST in WM_PROTOCOLS */
+static int syncreq_supported(Window win) {
+	Atom *protocols;
+	int n, found = 0;
+
+	if (!TRACE_X("XGetWMProtocols", XGetWMProtocols(dpy, win, &protocols, &n))) return 0;
+	for (int i = 0; i < n; i++) {
+		if (protocols[i] == net_wm_sync_request) found = 1;
+	}
+	XFree(protocols);
+	return found;
+}
+
+/* Look up the client's counter and create an alarm that fires when it catches up */
+void syncreq_manage(WindowNode *node) {
+	Atom type;
+	int format;
+	unsigned long n, after;
+	unsigned char *data = NULL;
+
+	node->sync_counter = None;
+	node->sync_alarm = None;
+	node->sync_value = 0;
+	node->sync_waiting = 0;
+	node->sync_timer = 0;
+	if (sync_event_base < 0 || !syncreq_supported(node->window)) return;
+
+	if (TRACE_X("XGetWindowProperty", XGetWindowProperty(dpy, node->window, net_wm_sync_request_counter,
+			0, 1, False, XA_CARDINAL, &type, &format, &n, &after, &data)) == Success && data) {
+		if (n == 1 && format == 32) node->sync_counter = *(unsigned long *)data;
+		XFree(data);
+	}
+	if (node->sync_counter == None) return;
+
+	XSyncAlarmAttributes attrs;
+	attrs.trigger.counter = node->sync_counter;
+	attrs.trigger.value_type = XSyncAbsolute;
+	attrs.trigger.test_type = XSyncPositiveComparison;
+	XSyncIntToValue(&attrs.trigger.wait_value, 0);
+	XSyncIntToValue(&attrs.delta, 0);
+	attrs.events = True;
+	node->sync_alarm = XSyncCreateAlarm(dpy, XSyncCACounter | XSyncCAValueType | XSyncCAValue |
+		XSyncCATestType | XSyncCADelta | XSyncCAEvents, &attrs);
+}
+
+void syncreq_unmanage(WindowNode *node) {
+	if (node->sync_timer) evloop_cancel_timer(node->sync_timer);
+	if (node->sync_alarm != None) XSyncDestroyAlarm(dpy, node->sync_alarm);
+	node->sync_timer = 0;
+	node->sync_alarm = None;
+	node->sync_counter = None;
+	node->sync_waiting = 0;
+}
+
+/* The previous request is finished, acknowledged or not; let the caller send more */
+static void syncreq_done(WindowNode *node) {
+	node->sync_waiting = 0;
+	if (node->sync_timer) evloop_cancel_timer(node->sync_timer);
+	node->sync_timer = 0;
+	ready_fn(node);
+}
+
+static void syncreq_timeout(void *arg) {
+	WindowNode *node = arg;
+	node->sync_timer = 0;
+	if (node->sync_waiting) syncreq_done(node);
+}
+
+/* Announce a resize to a syncing client. Returns 0 if the previous one has
+ * not been acknowledged yet and the resize must wait. */
+int syncreq_begin(WindowNode *node) {
+	if (node->sync_alarm == None) return 1;
+	if (node->sync_waiting) return 0;
+
+	node->sync_value++;
+	XEvent ev;
+	ev.xclient.type = ClientMessage;
+	ev.xclient.window = node->window;
+	ev.xclient.message_type = wm_protocols;
+	ev.xclient.format = 32;
+	ev.xclient.data.l[0] = net_wm_sync_request;
+	ev.xclient.data.l[1] = CurrentTime;
+	ev.xclient.data.l[2] = node->sync_value & 0xFFFFFFFFL;
+	ev.xclient.data.l[3] = (node->sync_value >> 32) & 0xFFFFFFFFL;
+	ev.xclient.data.l[4] = 0;
+	XSendEvent(dpy, node->window, False, NoEventMask, &ev);
+
+	/* Wake up once the counter reaches the value just sent */
+	XSyncAlarmAttributes attrs;
+	XSyncIntsToValue(&attrs.trigger.wait_value, node->sync_value & 0xFFFFFFFFL,
+		(int)(node->sync_value >> 32));
+	XSyncChangeAlarm(dpy, node->sync_alarm, XSyncCAValue, &attrs);
+
+	node->sync_waiting = 1;
+	node->sync_timer = evloop_add_timer(SYNC_TIMEOUT_US, syncreq_timeout, node);
+	return 1;
+}
+
+/* Handle alarm notifications; returns 1 if the event was consumed */
+int syncreq_handle_event(XEvent *ev, WindowNode *list) {
+	if (sync_event_base < 0 || ev->type != sync_event_base + XSyncAlarmNotify) return 0;
+
+	XSyncAlarmNotifyEvent *an = (XSyncAlarmNotifyEvent *)ev;
+	for (WindowNode *node = list; node; node = node->next) {
+		if (node->sync_alarm == an->alarm) {
+			if (node->sync_waiting) syncreq_done(node);
+			break;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,18 @@
+#ifndef SYNCREQ_H
+#define SYNCREQ_H
+
+#include <X11/Xlib.h>
+#include "main.h"
+
+#define SYNC_TIMEOUT_US 200000  /* Give up waiting on a client that stops answering */
+
+typedef void (*syncreq_ready_fn)(WindowNode *node);
+
+int syncreq_init(Display *display, syncreq_ready_fn ready);
+Atom syncreq_atom();
+void syncreq_manage(WindowNode *node);
+void syncreq_unmanage(WindowNode *node);
+int syncreq_begin(WindowNode *node);
+int syncreq_handle_event(XEvent *ev, WindowNode *list);
+
+#endif /* SYNCREQ_H */
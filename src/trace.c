@@ -0,0 +1,133 @@
+#include "trace.h"
+#include "audit.h"
+
+#ifdef TRACE
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* One span edge; names are string literals, so only the pointer is kept */
+typedef struct {
+	const char *name;
+	uint64_t ts_ns;
+	char phase;
+} trace_rec_t;
+
+/* Each thread writes only its own ring, so recording takes no lock. The
+ * head is published with release order for the writer at exit. */
+typedef struct {
+	_Atomic unsigned long head;  /* Records ever written; the slot is head % TRACE_RING */
+	int tid;
+	const char *name;
+	trace_rec_t recs[TRACE_RING];
+} trace_ring_t;
+
+static _Atomic(trace_ring_t *) rings[TRACE_MAX_THREADS];
+static atomic_int nrings;
+static _Thread_local trace_ring_t *ring;
+static _Thread_local int untraced;  /* Thread arrived after every ring was taken */
+static char path[256];
+
+static trace_ring_t *trace_ring() {
+	if (ring || untraced) return ring;
+
+	int idx = atomic_fetch_add(&nrings, 1);
+	trace_ring_t *r = idx < TRACE_MAX_THREADS ? calloc(1, sizeof(trace_ring_t)) : NULL;
+	if (!r) {
+		untraced = 1;
+		return NULL;
+	}
+	r->tid = idx + 1;
+	r->name = idx == 0 ? "main" : "thread";
+	atomic_store(&rings[idx], r);
+	ring = r;
+	return r;
+}
+
+void trace_event(const char *name, char phase) {
+	trace_ring_t *r = trace_ring();
+	if (!r) return;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	unsigned long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	trace_rec_t *rec = &r->recs[head % TRACE_RING];
+	rec->name = name;
+	rec->ts_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	rec->phase = phase;
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+/* Label the calling thread in the timeline */
+void trace_thread_name(const char *name) {
+	trace_ring_t *r = trace_ring();
+	if (r) r->name = name;
+}
+
+/* $SWM_TRACE names the output, /tmp/swm-trace-<pid>.json otherwise */
+void trace_init() {
+	const char *env = getenv("SWM_TRACE");
+	if (env && *env) snprintf(path, sizeof(path), "%s", env);
+	else snprintf(path, sizeof(path), "/tmp/swm-trace-%d.json", (int)getpid());
+	trace_thread_name("main");
+}
+
+/* Dump every ring, oldest record first; call once the other threads are joined */
+void trace_write() {
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		perror("swm: trace");
+		return;
+	}
+	int pid = getpid(), first = 1;
+	int n = atomic_load(&nrings);
+	if (n > TRACE_MAX_THREADS) n = TRACE_MAX_THREADS;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (int i = 0; i < n; i++) {
+		trace_ring_t *r = atomic_load(&rings[i]);
+		if (!r) continue;
+		fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			first ? "" : ",", pid, r->tid, r->name);
+		first = 0;
+
+		unsigned long head = atomic_load_explicit(&r->head, memory_order_acquire);
+		for (unsigned long j = head > TRACE_RING ? head - TRACE_RING : 0; j < head; j++) {
+			trace_rec_t *rec = &r->recs[j % TRACE_RING];
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d}",
+				rec->name, rec->phase, (unsigned long long)(rec->ts_ns / 1000),
+				(unsigned long long)(rec->ts_ns % 1000), pid, r->tid);
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	fprintf(stderr, "swm: trace written to %s\n", path);
+}
+
+#else
+
+void trace_event(const char *name, char phase) {}
+void trace_thread_name(const char *name) {}
+void trace_init() {}
+void trace_write() {}
+
+#endif
+
+/* Wrapped X calls feed both the timeline and the round-trip audit */
+void trace_x_begin(const char *name) {
+	TRACE_BEGIN(name);
+#ifdef AUDIT
+	audit_call_begin();
+#endif
+}
+
+long trace_x_end(const char *name, long value) {
+#ifdef AUDIT
+	audit_call_end(name);
+#endif
+	TRACE_END(name);
+	return value;
+}
@@ -0,0 +1,37 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_RING 65536       /* Spans kept per thread; the oldest are overwritten */
+#define TRACE_MAX_THREADS 8
+
+/* Timeline spans, written as Chrome trace-event JSON on exit (make TRACE=1).
+ * TRACE_X wraps an X call that waits for a reply and yields its result;
+ * TRACE_X_BEGIN/END bracket one that returns a pointer. Round-trip auditing
+ * (make AUDIT=1) counts the same call sites. With neither, the macros compile
+ * to nothing and TRACE_X to the bare call. */
+#ifdef TRACE
+#define TRACE_BEGIN(name) trace_event((name), 'B')
+#define TRACE_END(name) trace_event((name), 'E')
+#else
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name) ((void)0)
+#endif
+
+#if defined(TRACE) || defined(AUDIT)
+#define TRACE_X(name, call) (trace_x_begin(name), trace_x_end((name), (long)(call)))
+#define TRACE_X_BEGIN(name) trace_x_begin(name)
+#define TRACE_X_END(name) trace_x_end((name), 0)
+#else
+#define TRACE_X(name, call) (call)
+#define TRACE_X_BEGIN(name) ((void)0)
+#define TRACE_X_END(name) ((void)0)
+#endif
+
+void trace_event(const char *name, char phase);
+void trace_x_begin(const char *name);
+long trace_x_end(const char *name, long value);
+void trace_thread_name(const char *name);
+void trace_init();
+void trace_write();
+
+#endif /* TRACE_H */
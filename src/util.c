@@ -46,3 +46,22 @@ void make_cursor(Display *display, Window win) {
 	XDefineCursor(display, win, cursor);
 }
 
+
+/* Record a monotonic start point for timer_elapsed_us() */
+void timer_start(struct timespec *ts) {
+	clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+/* Microseconds elapsed since timer_start() */
+long timer_elapsed_us(const struct timespec *ts) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - ts->tv_sec) * 1000000L + (now.tv_nsec - ts->tv_nsec) / 1000L;
+}
+
+/* Nanoseconds elapsed since timer_start() */
+long timer_elapsed_ns(const struct timespec *ts) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - ts->tv_sec) * 1000000000L + (now.tv_nsec - ts->tv_nsec);
+}
@@ -5,6 +5,7 @@
 #include <X11/Xutil.h>
 #include <X11/cursorfont.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 void spawn(const char *cmd);
@@ -12,6 +13,9 @@ void make_cursor(Display *display, Window win);
 void hide_cursor(Display *display, Window win);
 void show_cursor(Display *display, Window win);
 void free_cursor(Display *display, Window win);
+void timer_start(struct timespec *ts);
+long timer_elapsed_us(const struct timespec *ts);
+long timer_elapsed_ns(const struct timespec *ts);
 
 #endif /* UTIL_H */
 
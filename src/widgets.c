@@ -1,5 +1,4 @@
-#include "xlib_widgets.h"
-#include <ctype.h>
+#include "widgets.h"
 
 // Color definitions
 #define COLOR_WHITE 0xFFFFFF
@@ -17,7 +16,11 @@ WidgetManager* widget_manager_create(Display* display) {
     wm->screen = DefaultScreen(display);
     wm->root = RootWindow(display, wm->screen);
     wm->widgets = NULL;
+    wm->toplevels = NULL;
     wm->focused_widget = NULL;
+    wm->pressed_widget = NULL;
+    wm->dirty_count = 0;
+    memset(wm->buckets, 0, sizeof(wm->buckets));
     
     // Create graphics context
     wm->gc = XCreateGC(display, wm->root, 0, NULL);
@@ -29,6 +32,15 @@ WidgetManager* widget_manager_create(Display* display) {
     }
     XSetFont(display, wm->gc, wm->font->fid);
     
+    // UTF-8 text goes through a font set and an input method when the locale allows
+    char** missing = NULL;
+    int nmissing = 0;
+    char* def_string = NULL;
+    wm->fontset = XCreateFontSet(display, "fixed,-*-*-medium-r-normal--13-*-*-*-*-*-*-*",
+                                 &missing, &nmissing, &def_string);
+    if (missing) XFreeStringList(missing);
+    wm->xim = XOpenIM(display, NULL, NULL, NULL);
+    
     // Set up colors
     Colormap colormap = DefaultColormap(display, wm->screen);
     XColor color;
@@ -62,122 +74,261 @@ void widget_manager_destroy(WidgetManager* wm) {
         widget = next;
     }
     
+    if (wm->xim) XCloseIM(wm->xim);
+    if (wm->fontset) XFreeFontSet(wm->display, wm->fontset);
     if (wm->font) XFreeFont(wm->display, wm->font);
     XFreeGC(wm->display, wm->gc);
     free(wm);
 }
 
+// Bucket for a window id
+static unsigned int widget_hash(Window window) {
+    return (unsigned int)((window * 2654435761u) >> 7) % WIDGET_HASH_SIZE;
+}
+
+static WidgetToplevel* toplevel_find(WidgetManager* wm, Window window) {
+    WidgetToplevel* tl = wm->buckets[widget_hash(window)];
+    while (tl) {
+        if (tl->window == window) return tl;
+        tl = tl->hash_next;
+    }
+    return NULL;
+}
+
+// Look up or start tracking the toplevel a widget is created in
+static WidgetToplevel* toplevel_get(WidgetManager* wm, Window window) {
+    WidgetToplevel* tl = toplevel_find(wm, window);
+    if (tl) return tl;
+    
+    tl = calloc(1, sizeof(WidgetToplevel));
+    if (!tl) return NULL;
+    tl->window = window;
+    tl->buffer = None;
+    tl->stale = 1;
+    
+    // Widget input now arrives on the toplevel; keep whatever its owner selected
+    XWindowAttributes attrs;
+    long mask = 0;
+    if (XGetWindowAttributes(wm->display, window, &attrs)) {
+        mask = attrs.your_event_mask;
+    }
+    XSelectInput(wm->display, window, mask | ExposureMask | ButtonPressMask |
+                 ButtonReleaseMask | KeyPressMask | FocusChangeMask);
+    
+    tl->next = wm->toplevels;
+    wm->toplevels = tl;
+    unsigned int h = widget_hash(window);
+    tl->hash_next = wm->buckets[h];
+    wm->buckets[h] = tl;
+    return tl;
+}
+
+// Forget a toplevel once its last widget is gone
+static void toplevel_release(WidgetManager* wm, WidgetToplevel* tl) {
+    WidgetToplevel** link = &wm->toplevels;
+    while (*link && *link != tl) link = &(*link)->next;
+    if (*link) *link = tl->next;
+    
+    link = &wm->buckets[widget_hash(tl->window)];
+    while (*link && *link != tl) link = &(*link)->hash_next;
+    if (*link) *link = tl->hash_next;
+    
+    if (tl->buffer != None) XFreePixmap(wm->display, tl->buffer);
+    free(tl);
+}
+
+// Add a rectangle (window coordinates) to the area presented on the next flush
+static void toplevel_damage(WidgetToplevel* tl, int x, int y, int width, int height) {
+    if (width <= 0 || height <= 0) return;
+    if (tl->dx1 >= tl->dx2) {
+        tl->dx1 = x;
+        tl->dy1 = y;
+        tl->dx2 = x + width;
+        tl->dy2 = y + height;
+        return;
+    }
+    if (x < tl->dx1) tl->dx1 = x;
+    if (y < tl->dy1) tl->dy1 = y;
+    if (x + width > tl->dx2) tl->dx2 = x + width;
+    if (y + height > tl->dy2) tl->dy2 = y + height;
+}
+
+// Size the back buffer to the bounding box of the toplevel's widgets
+static void toplevel_layout(WidgetManager* wm, WidgetToplevel* tl) {
+    int x1 = 0, y1 = 0, x2 = 0, y2 = 0, first = 1;
+    
+    for (Widget* widget = wm->widgets; widget; widget = widget->next) {
+        if (widget->toplevel != tl) continue;
+        int wx2 = widget->x + widget->width + 2 * widget->border;
+        int wy2 = widget->y + widget->height + 2 * widget->border;
+        if (first || widget->x < x1) x1 = widget->x;
+        if (first || widget->y < y1) y1 = widget->y;
+        if (first || wx2 > x2) x2 = wx2;
+        if (first || wy2 > y2) y2 = wy2;
+        first = 0;
+    }
+    tl->stale = 0;
+    if (first) return;
+    
+    if (tl->buffer == None || x2 - x1 != tl->bw || y2 - y1 != tl->bh) {
+        if (tl->buffer != None) XFreePixmap(wm->display, tl->buffer);
+        tl->bw = x2 - x1;
+        tl->bh = y2 - y1;
+        tl->buffer = XCreatePixmap(wm->display, tl->window, tl->bw, tl->bh,
+                                   DefaultDepth(wm->display, wm->screen));
+    }
+    tl->bx = x1;
+    tl->by = y1;
+    
+    // Buffer contents no longer line up with the widgets
+    for (Widget* widget = wm->widgets; widget; widget = widget->next) {
+        if (widget->toplevel == tl) widget_invalidate(wm, widget);
+    }
+}
+
 void widget_add_to_manager(WidgetManager* wm, Widget* widget) {
     widget->next = wm->widgets;
     wm->widgets = widget;
+    widget->toplevel->widget_count++;
+    widget->toplevel->stale = 1;
+    
+    // New widgets need their first paint
+    widget->dirty = 0;
+    widget_invalidate(wm, widget);
 }
 
-Widget* widget_find_by_window(WidgetManager* wm, Window window) {
-    Widget* widget = wm->widgets;
-    while (widget) {
-        if (widget->window == window) return widget;
-        widget = widget->next;
+void widget_remove_from_manager(WidgetManager* wm, Widget* widget) {
+    // Remove from linked list
+    if (wm->widgets == widget) {
+        wm->widgets = widget->next;
+    } else {
+        Widget* current = wm->widgets;
+        while (current && current->next != widget) {
+            current = current->next;
+        }
+        if (current) {
+            current->next = widget->next;
+        }
+    }
+    
+    if (widget->dirty) {
+        wm->dirty_count--;
+    }
+    if (wm->pressed_widget == widget) {
+        wm->pressed_widget = NULL;
+    }
+    
+    WidgetToplevel* tl = widget->toplevel;
+    if (--tl->widget_count == 0) {
+        toplevel_release(wm, tl);
+    } else {
+        tl->stale = 1;
+    }
+}
+
+// Topmost visible widget of a toplevel under a point in window coordinates
+Widget* widget_find_at(WidgetManager* wm, Window window, int x, int y) {
+    for (Widget* widget = wm->widgets; widget; widget = widget->next) {
+        if (widget->window != window || !widget->visible) continue;
+        if (x >= widget->x && y >= widget->y &&
+            x < widget->x + widget->width + 2 * widget->border &&
+            y < widget->y + widget->height + 2 * widget->border) {
+            return widget;
+        }
     }
     return NULL;
 }
 
-// Button creation
-Widget* widget_create_button(WidgetManager* wm, Window parent, int x, int y, 
-                           int width, int height, const char* text, 
-                           WidgetCallback callback, void* user_data) {
+// Allocate a widget with default state inside a toplevel
+static Widget* widget_new(WidgetManager* wm, WidgetType type, Window parent, int x, int y,
+                          int width, int height, int border) {
     Widget* widget = malloc(sizeof(Widget));
     if (!widget) return NULL;
     
-    widget->type = WIDGET_BUTTON;
+    widget->toplevel = toplevel_get(wm, parent);
+    if (!widget->toplevel) {
+        free(widget);
+        return NULL;
+    }
+    
+    widget->type = type;
+    widget->window = parent;
     widget->x = x;
     widget->y = y;
     widget->width = width;
     widget->height = height;
-    widget->text = strdup(text);
-    widget->text_len = strlen(text);
+    widget->border = border;
+    widget->visible = 1;
+    widget->text = NULL;
+    widget->text_len = 0;
     widget->max_text_len = 0;
     widget->cursor_pos = 0;
     widget->focused = 0;
     widget->pressed = 0;
-    widget->callback = callback;
-    widget->user_data = user_data;
+    widget->masked = 0;
+    widget->dirty = 0;
+    widget->gap = NULL;
+    widget->gap_start = widget->gap_end = widget->capacity = 0;
+    widget->cursor_x = 0;
+    widget->redraw_from = -1;
+    widget->redraw_x = 0;
+    widget->scroll_x = 0;
+    widget->xic = NULL;
+    widget->callback = NULL;
+    widget->user_data = NULL;
     widget->next = NULL;
+    return widget;
+}
+
+// Button creation
+Widget* widget_create_button(WidgetManager* wm, Window parent, int x, int y, 
+                           int width, int height, const char* text, 
+                           WidgetCallback callback, void* user_data) {
+    Widget* widget = widget_new(wm, WIDGET_BUTTON, parent, x, y, width, height, 1);
+    if (!widget) return NULL;
     
-    widget->window = XCreateSimpleWindow(wm->display, parent, x, y, width, height,
-                                       1, wm->fg_color, wm->bg_color);
-    
-    XSelectInput(wm->display, widget->window, 
-                ExposureMask | ButtonPressMask | ButtonReleaseMask | 
-                EnterWindowMask | LeaveWindowMask);
+    widget->text = strdup(text);
+    widget->text_len = strlen(text);
+    widget->callback = callback;
+    widget->user_data = user_data;
     
-    XMapWindow(wm->display, widget->window);
     widget_add_to_manager(wm, widget);
-    
     return widget;
 }
 
 // Label creation
 Widget* widget_create_label(WidgetManager* wm, Window parent, int x, int y, 
                           int width, int height, const char* text) {
-    Widget* widget = malloc(sizeof(Widget));
+    Widget* widget = widget_new(wm, WIDGET_LABEL, parent, x, y, width, height, 1);
     if (!widget) return NULL;
     
-    widget->type = WIDGET_LABEL;
-    widget->x = x;
-    widget->y = y;
-    widget->width = width;
-    widget->height = height;
     widget->text = strdup(text);
     widget->text_len = strlen(text);
-    widget->max_text_len = 0;
-    widget->cursor_pos = 0;
-    widget->focused = 0;
-    widget->pressed = 0;
-    widget->callback = NULL;
-    widget->user_data = NULL;
-    widget->next = NULL;
-    
-    widget->window = XCreateSimpleWindow(wm->display, parent, x, y, width, height,
-                                       1, wm->fg_color, wm->bg_color);
     
-    XSelectInput(wm->display, widget->window, ExposureMask);
-    XMapWindow(wm->display, widget->window);
     widget_add_to_manager(wm, widget);
-    
     return widget;
 }
 
 // Textbox creation
 Widget* widget_create_textbox(WidgetManager* wm, Window parent, int x, int y, 
                             int width, int height, int max_len) {
-    Widget* widget = malloc(sizeof(Widget));
+    Widget* widget = widget_new(wm, WIDGET_TEXTBOX, parent, x, y, width, height, 2);
     if (!widget) return NULL;
     
-    widget->type = WIDGET_TEXTBOX;
-    widget->x = x;
-    widget->y = y;
-    widget->width = width;
-    widget->height = height;
     widget->text = malloc(max_len + 1);
+    if (!widget->text) {
+        free(widget);
+        return NULL;
+    }
     widget->text[0] = '\0';
-    widget->text_len = 0;
     widget->max_text_len = max_len;
-    widget->cursor_pos = 0;
-    widget->focused = 0;
-    widget->pressed = 0;
-    widget->callback = NULL;
-    widget->user_data = NULL;
-    widget->next = NULL;
-    
-    widget->window = XCreateSimpleWindow(wm->display, parent, x, y, width, height,
-                                       2, wm->fg_color, wm->bg_color);
     
-    XSelectInput(wm->display, widget->window, 
-                ExposureMask | ButtonPressMask | KeyPressMask | FocusChangeMask);
+    if (wm->xim) {
+        widget->xic = XCreateIC(wm->xim, XNInputStyle, XIMPreeditNothing | XIMStatusNothing,
+                                XNClientWindow, parent, XNFocusWindow, parent, NULL);
+    }
     
-    XMapWindow(wm->display, widget->window);
     widget_add_to_manager(wm, widget);
-    
     return widget;
 }
 
@@ -185,28 +336,148 @@ Widget* widget_create_textbox(WidgetManager* wm, Window parent, int x, int y,
 void widget_destroy(WidgetManager* wm, Widget* widget) {
     if (!widget) return;
     
-    // Remove from linked list
-    if (wm->widgets == widget) {
-        wm->widgets = widget->next;
-    } else {
-        Widget* current = wm->widgets;
-        while (current && current->next != widget) {
-            current = current->next;
-        }
-        if (current) {
-            current->next = widget->next;
-        }
-    }
+    widget_remove_from_manager(wm, widget);
     
     if (wm->focused_widget == widget) {
         wm->focused_widget = NULL;
     }
     
-    XDestroyWindow(wm->display, widget->window);
+    if (widget->visible) {
+        XClearArea(wm->display, widget->window, widget->x, widget->y,
+                   widget->width + 2 * widget->border, widget->height + 2 * widget->border, False);
+    }
+    if (widget->xic) XDestroyIC(widget->xic);
+    free(widget->gap);
     free(widget->text);
     free(widget);
 }
 
+// Gap buffer helpers
+
+// Bytes after the gap
+static int gap_post_len(Widget* widget) {
+    return widget->capacity - widget->gap_end;
+}
+
+// Make room for len more bytes in the gap, growing up to max_text_len
+static int gap_reserve(Widget* widget, int len) {
+    if (widget->gap_end - widget->gap_start >= len) return 1;
+    if (widget->text_len + len > widget->max_text_len) return 0;
+    
+    int post = gap_post_len(widget);
+    int capacity = widget->capacity ? widget->capacity : 32;
+    while (capacity - widget->text_len < len) capacity *= 2;
+    if (capacity > widget->max_text_len || widget->masked) capacity = widget->max_text_len;
+    
+    char* gap = realloc(widget->gap, capacity);
+    if (!gap) return 0;
+    memmove(gap + capacity - post, gap + widget->gap_end, post);
+    widget->gap = gap;
+    widget->gap_end = capacity - post;
+    widget->capacity = capacity;
+    return 1;
+}
+
+// Move the gap (and so the cursor) to byte offset pos
+static void gap_move(Widget* widget, int pos) {
+    if (pos < widget->gap_start) {
+        int n = widget->gap_start - pos;
+        memmove(widget->gap + widget->gap_end - n, widget->gap + pos, n);
+        widget->gap_start -= n;
+        widget->gap_end -= n;
+    } else if (pos > widget->gap_start) {
+        int n = pos - widget->gap_start;
+        memmove(widget->gap + widget->gap_start, widget->gap + widget->gap_end, n);
+        widget->gap_start += n;
+        widget->gap_end += n;
+    }
+    widget->cursor_pos = widget->gap_start;
+}
+
+// Length of the UTF-8 sequence ending just before the cursor
+static int gap_prev_len(Widget* widget) {
+    int n = 0;
+    while (n < widget->gap_start && n < 4) {
+        n++;
+        if ((widget->gap[widget->gap_start - n] & 0xC0) != 0x80) break;
+    }
+    return n;
+}
+
+// Length of the UTF-8 sequence starting at the cursor
+static int gap_next_len(Widget* widget) {
+    int post = gap_post_len(widget);
+    if (post == 0) return 0;
+    
+    unsigned char c = widget->gap[widget->gap_end];
+    int n = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 1;
+    return n < post ? n : post;
+}
+
+// Number of UTF-8 characters in a run
+static int utf8_count(const char* s, int len) {
+    int n = 0;
+    for (int i = 0; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) n++;
+    }
+    return n;
+}
+
+// Masked textboxes show one '*' per character
+static const char* widget_mask_run(int* len, const char* s) {
+    static char mask[256];
+    int n = utf8_count(s, *len);
+    if (n > (int)sizeof(mask)) n = sizeof(mask);
+    memset(mask, '*', n);
+    *len = n;
+    return mask;
+}
+
+// Pixel width of a UTF-8 run as the widget displays it
+static int widget_run_width(WidgetManager* wm, Widget* widget, const char* s, int len) {
+    if (len <= 0) return 0;
+    if (widget->masked) {
+        s = widget_mask_run(&len, s);
+        return XTextWidth(wm->font, s, len);
+    }
+    if (wm->fontset) {
+        return Xutf8TextEscapement(wm->fontset, s, len);
+    }
+    return XTextWidth(wm->font, s, len);
+}
+
+// Draw a UTF-8 run into a drawable and return its advance
+static int widget_draw_run(WidgetManager* wm, Widget* widget, Drawable d, int x, int y,
+                           const char* s, int len) {
+    if (len <= 0) return 0;
+    if (widget->masked) {
+        s = widget_mask_run(&len, s);
+        XDrawString(wm->display, d, wm->gc, x, y, s, len);
+        return XTextWidth(wm->font, s, len);
+    }
+    if (wm->fontset) {
+        Xutf8DrawString(wm->display, d, wm->fontset, wm->gc, x, y, s, len);
+        return Xutf8TextEscapement(wm->fontset, s, len);
+    }
+    XDrawString(wm->display, d, wm->gc, x, y, s, len);
+    return XTextWidth(wm->font, s, len);
+}
+
+// Mark the textbox for repaint from byte pos (at pixel x) onwards
+static void widget_textbox_damage(WidgetManager* wm, Widget* widget, int pos, int x) {
+    if (widget->dirty) {
+        if (widget->redraw_from >= 0 && pos < widget->redraw_from) {
+            widget->redraw_from = pos;
+            widget->redraw_x = x;
+        }
+        return;
+    }
+    widget->dirty = 1;
+    widget->redraw_from = pos;
+    widget->redraw_x = x;
+    wm->dirty_count++;
+}
+
 // Text operations
 void widget_set_text(Widget* widget, const char* text) {
     if (!widget || !text) return;
@@ -216,10 +487,17 @@ void widget_set_text(Widget* widget, const char* text) {
         if (len > widget->max_text_len) {
             len = widget->max_text_len;
         }
-        strncpy(widget->text, text, len);
-        widget->text[len] = '\0';
-        widget->text_len = len;
-        widget->cursor_pos = len;
+        widget->gap_start = 0;
+        widget->gap_end = widget->capacity;
+        widget->text_len = 0;
+        if (len > 0 && gap_reserve(widget, len)) {
+            memcpy(widget->gap, text, len);
+            widget->gap_start = len;
+            widget->text_len = len;
+        }
+        widget->cursor_pos = widget->gap_start;
+        widget->cursor_x = -1;
+        widget->text[0] = '\0';
     } else {
         free(widget->text);
         widget->text = strdup(text);
@@ -228,6 +506,13 @@ void widget_set_text(Widget* widget, const char* text) {
 }
 
 const char* widget_get_text(Widget* widget) {
+    if (widget && widget->type == WIDGET_TEXTBOX) {
+        // Flatten the gap buffer into the contiguous copy
+        int post = gap_post_len(widget);
+        memcpy(widget->text, widget->gap, widget->gap_start);
+        memcpy(widget->text + widget->gap_start, widget->gap + widget->gap_end, post);
+        widget->text[widget->text_len] = '\0';
+    }
     return widget ? widget->text : NULL;
 }
 
@@ -235,62 +520,220 @@ const char* widget_get_text(Widget* widget) {
 void widget_set_focus(WidgetManager* wm, Widget* widget) {
     if (wm->focused_widget) {
         wm->focused_widget->focused = 0;
-        widget_draw(wm, wm->focused_widget);
+        widget_invalidate(wm, wm->focused_widget);
     }
     
     wm->focused_widget = widget;
     if (widget && widget->type == WIDGET_TEXTBOX) {
         widget->focused = 1;
         XSetInputFocus(wm->display, widget->window, RevertToParent, CurrentTime);
-        widget_draw(wm, widget);
+        if (widget->xic) XSetICFocus(widget->xic);
+        widget_invalidate(wm, widget);
     } else {
         wm->focused_widget = NULL;
     }
 }
 
-// Textbox character operations
-void widget_textbox_insert_char(Widget* widget, char c) {
-    if (!widget || widget->type != WIDGET_TEXTBOX) return;
-    if (widget->text_len >= widget->max_text_len) return;
-    if (!isprint(c)) return;
+// Textbox editing; all edits happen at the gap so each is O(1) amortized
+
+void widget_textbox_insert(WidgetManager* wm, Widget* widget, const char* s, int len) {
+    if (!widget || widget->type != WIDGET_TEXTBOX || len <= 0) return;
     
-    // Shift characters to the right
-    for (int i = widget->text_len; i >= widget->cursor_pos; i--) {
-        widget->text[i + 1] = widget->text[i];
+    // Drop control characters; UTF-8 lead and continuation bytes pass
+    for (int i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c < 0x20 || c == 0x7F) return;
     }
+    if (!gap_reserve(widget, len)) return;
     
-    widget->text[widget->cursor_pos] = c;
-    widget->cursor_pos++;
-    widget->text_len++;
+    if (widget->cursor_x >= 0) {
+        widget_textbox_damage(wm, widget, widget->gap_start, widget->cursor_x);
+    } else {
+        widget_invalidate(wm, widget);
+    }
+    
+    memcpy(widget->gap + widget->gap_start, s, len);
+    widget->gap_start += len;
+    widget->text_len += len;
+    widget->cursor_pos = widget->gap_start;
+    if (widget->cursor_x >= 0) {
+        widget->cursor_x += widget_run_width(wm, widget, s, len);
+    }
 }
 
-void widget_textbox_delete_char(Widget* widget) {
+void widget_textbox_delete_char(WidgetManager* wm, Widget* widget) {
     if (!widget || widget->type != WIDGET_TEXTBOX) return;
-    if (widget->cursor_pos == 0) return;
     
-    // Shift characters to the left
-    for (int i = widget->cursor_pos - 1; i < widget->text_len; i++) {
-        widget->text[i] = widget->text[i + 1];
+    int n = gap_prev_len(widget);
+    if (n == 0) return;
+    
+    widget->gap_start -= n;
+    widget->text_len -= n;
+    widget->cursor_pos = widget->gap_start;
+    if (widget->cursor_x >= 0) {
+        widget->cursor_x -= widget_run_width(wm, widget, widget->gap + widget->gap_start, n);
+        widget_textbox_damage(wm, widget, widget->gap_start, widget->cursor_x);
+    } else {
+        widget_invalidate(wm, widget);
     }
+}
+
+void widget_textbox_move_cursor(WidgetManager* wm, Widget* widget, int direction) {
+    if (!widget || widget->type != WIDGET_TEXTBOX) return;
+    
+    int old = widget->gap_start;
+    int old_x = widget->cursor_x;
     
-    widget->cursor_pos--;
-    widget->text_len--;
+    if (direction < 0) {
+        int n = gap_prev_len(widget);
+        if (n == 0) return;
+        gap_move(widget, widget->gap_start - n);
+        if (widget->cursor_x >= 0) {
+            widget->cursor_x -= widget_run_width(wm, widget, widget->gap + widget->gap_end, n);
+        }
+    } else if (direction > 0) {
+        int n = gap_next_len(widget);
+        if (n == 0) return;
+        gap_move(widget, widget->gap_start + n);
+        if (widget->cursor_x >= 0) {
+            widget->cursor_x += widget_run_width(wm, widget, widget->gap + widget->gap_start - n, n);
+        }
+    }
+    
+    // Repaint from whichever cursor position is further left
+    if (old_x >= 0 && widget->cursor_x >= 0) {
+        if (widget->gap_start < old) {
+            widget_textbox_damage(wm, widget, widget->gap_start, widget->cursor_x);
+        } else {
+            widget_textbox_damage(wm, widget, old, old_x);
+        }
+    } else {
+        widget_invalidate(wm, widget);
+    }
 }
 
-void widget_textbox_move_cursor(Widget* widget, int direction) {
+void widget_textbox_set_cursor(WidgetManager* wm, Widget* widget, int pos) {
     if (!widget || widget->type != WIDGET_TEXTBOX) return;
+    if (pos < 0) pos = 0;
+    if (pos > widget->text_len) pos = widget->text_len;
+    
+    int old = widget->gap_start;
+    int old_x = widget->cursor_x;
+    gap_move(widget, pos);
+    widget->cursor_x = widget_run_width(wm, widget, widget->gap, widget->gap_start);
     
-    if (direction < 0 && widget->cursor_pos > 0) {
-        widget->cursor_pos--;
-    } else if (direction > 0 && widget->cursor_pos < widget->text_len) {
-        widget->cursor_pos++;
+    if (old_x >= 0 && old < widget->gap_start) {
+        widget_textbox_damage(wm, widget, old, old_x);
+    } else {
+        widget_textbox_damage(wm, widget, widget->gap_start, widget->cursor_x);
     }
 }
 
-// Drawing functions
+// Zero a buffer in a way the compiler cannot drop as a dead store
+static void widget_wipe(char* buf, int len) {
+    volatile char* p = buf;
+    while (len-- > 0) *p++ = 0;
+}
+
+// Wipe the contents, e.g. after a password was read
+void widget_textbox_clear(WidgetManager* wm, Widget* widget) {
+    if (!widget || widget->type != WIDGET_TEXTBOX) return;
+    
+    // Masked textboxes allocate their whole capacity up front, so the gap
+    // buffer is never reallocated and this reaches every copy
+    if (widget->gap) widget_wipe(widget->gap, widget->capacity);
+    widget_wipe(widget->text, widget->max_text_len + 1);
+    widget_set_text(widget, "");
+    widget->cursor_x = 0;
+    widget_invalidate(wm, widget);
+}
+
+// Drawing functions; everything is painted into the toplevel's back buffer
+
+// Scroll so the cursor stays inside the field; returns 1 if the offset changed
+static int widget_textbox_scroll(Widget* widget) {
+    int field = widget->width - 10;
+    int scroll = widget->scroll_x;
+    
+    if (field < 1) field = 1;
+    if (widget->cursor_x - scroll > field) {
+        scroll = widget->cursor_x - field;
+    } else if (widget->cursor_x < scroll) {
+        // Going back left, show half a field of context before the cursor
+        scroll = widget->cursor_x > field / 2 ? widget->cursor_x - field / 2 : 0;
+    }
+    if (scroll == widget->scroll_x) return 0;
+    widget->scroll_x = scroll;
+    return 1;
+}
+
+// Repaint a textbox from redraw_from onwards, leaving the glyphs before it alone
+static void widget_draw_textbox_tail(WidgetManager* wm, Widget* widget) {
+    WidgetToplevel* tl = widget->toplevel;
+    int ox = widget->x + widget->border - tl->bx;
+    int oy = widget->y + widget->border - tl->by;
+    int text_y = (widget->height + wm->font->ascent - wm->font->descent) / 2;
+    int inset = 2;
+    
+    // A scroll moves every glyph, so the whole run is repainted
+    if (widget_textbox_scroll(widget)) {
+        widget->redraw_from = 0;
+        widget->redraw_x = 0;
+    }
+    int x = 5 + widget->redraw_x - widget->scroll_x;
+    int fill_x = x > inset ? x : inset;
+    int fill_w = widget->width - inset - fill_x;
+    if (fill_w < 0) fill_w = 0;
+    
+    XSetForeground(wm->display, wm->gc, widget->focused ? wm->focus_color : wm->bg_color);
+    XFillRectangle(wm->display, tl->buffer, wm->gc, ox + fill_x, oy + inset,
+                   fill_w, widget->height - 2 * inset);
+    
+    // Text past either edge of the field is clipped away
+    XRectangle clip = { ox + inset, oy + inset, widget->width - 2 * inset, widget->height - 2 * inset };
+    XSetClipRectangles(wm->display, wm->gc, 0, 0, &clip, 1, Unsorted);
+    XSetForeground(wm->display, wm->gc, wm->fg_color);
+    int end = x + widget_draw_run(wm, widget, tl->buffer, ox + x, oy + text_y,
+                                  widget->gap + widget->redraw_from,
+                                  widget->gap_start - widget->redraw_from);
+    widget_draw_run(wm, widget, tl->buffer, ox + end, oy + text_y,
+                    widget->gap + widget->gap_end, gap_post_len(widget));
+    
+    if (widget->focused) {
+        int cursor_x = 5 + widget->cursor_x - widget->scroll_x;
+        XDrawLine(wm->display, tl->buffer, wm->gc, 
+                 ox + cursor_x, oy + 3, ox + cursor_x, oy + widget->height - 3);
+    }
+    XSetClipMask(wm->display, wm->gc, None);
+    
+    toplevel_damage(tl, tl->bx + ox + fill_x, tl->by + oy + inset,
+                    fill_w, widget->height - 2 * inset);
+}
+
 void widget_draw(WidgetManager* wm, Widget* widget) {
-    if (!widget) return;
+    if (!widget || !widget->visible) return;
+    
+    WidgetToplevel* tl = widget->toplevel;
+    if (tl->stale || tl->buffer == None) {
+        toplevel_layout(wm, tl);
+    }
     
+    if (widget->type == WIDGET_TEXTBOX) {
+        if (widget->cursor_x < 0) {
+            widget->cursor_x = widget_run_width(wm, widget, widget->gap, widget->gap_start);
+        }
+        
+        // Edits only repaint the glyph run from the edit point onward
+        if (widget->redraw_from >= 0) {
+            widget_draw_textbox_tail(wm, widget);
+            widget->redraw_from = -1;
+            return;
+        }
+    }
+    
+    int bw = widget->border;
+    int ox = widget->x + bw - tl->bx;
+    int oy = widget->y + bw - tl->by;
     unsigned long bg_color = wm->bg_color;
     
     // Determine background color based on state
@@ -300,20 +743,33 @@ void widget_draw(WidgetManager* wm, Widget* widget) {
         bg_color = wm->focus_color;
     }
     
-    // Clear the window with background color
+    // Outer border, drawn where an X window border would be
+    XSetForeground(wm->display, wm->gc, wm->fg_color);
+    XFillRectangle(wm->display, tl->buffer, wm->gc, ox - bw, oy - bw,
+                   widget->width + 2 * bw, widget->height + 2 * bw);
+    
+    // Clear the widget with background color
     XSetForeground(wm->display, wm->gc, bg_color);
-    XFillRectangle(wm->display, widget->window, wm->gc, 0, 0, 
+    XFillRectangle(wm->display, tl->buffer, wm->gc, ox, oy, 
                    widget->width, widget->height);
+    toplevel_damage(tl, widget->x, widget->y, widget->width + 2 * bw, widget->height + 2 * bw);
     
     // Draw border for textbox
     if (widget->type == WIDGET_TEXTBOX) {
         XSetForeground(wm->display, wm->gc, wm->fg_color);
-        XDrawRectangle(wm->display, widget->window, wm->gc, 0, 0, 
+        XDrawRectangle(wm->display, tl->buffer, wm->gc, ox, oy, 
                       widget->width - 1, widget->height - 1);
         if (widget->focused) {
-            XDrawRectangle(wm->display, widget->window, wm->gc, 1, 1, 
+            XDrawRectangle(wm->display, tl->buffer, wm->gc, ox + 1, oy + 1, 
                           widget->width - 3, widget->height - 3);
         }
+        
+        // The textbox is a full repaint of its tail from the first byte
+        widget->redraw_from = 0;
+        widget->redraw_x = 0;
+        widget_draw_textbox_tail(wm, widget);
+        widget->redraw_from = -1;
+        return;
     }
     
     // Draw text
@@ -329,126 +785,220 @@ void widget_draw(WidgetManager* wm, Widget* widget) {
             text_x = (widget->width - text_width) / 2;
         }
         
-        XDrawString(wm->display, widget->window, wm->gc, text_x, text_y,
+        XDrawString(wm->display, tl->buffer, wm->gc, ox + text_x, oy + text_y,
                    widget->text, widget->text_len);
     }
+}
+
+// Copy the damaged part of each back buffer to its window
+static int widget_manager_present(WidgetManager* wm) {
+    int presented = 0;
     
-    // Draw cursor for focused textbox
-    if (widget->type == WIDGET_TEXTBOX && widget->focused) {
-        XSetForeground(wm->display, wm->gc, wm->fg_color);
+    for (WidgetToplevel* tl = wm->toplevels; tl; tl = tl->next) {
+        if (tl->dx1 >= tl->dx2 || tl->buffer == None) continue;
         
-        int cursor_x = 5;
-        if (widget->cursor_pos > 0) {
-            cursor_x += XTextWidth(wm->font, widget->text, widget->cursor_pos);
+        int x1 = tl->dx1 > tl->bx ? tl->dx1 : tl->bx;
+        int y1 = tl->dy1 > tl->by ? tl->dy1 : tl->by;
+        int x2 = tl->dx2 < tl->bx + tl->bw ? tl->dx2 : tl->bx + tl->bw;
+        int y2 = tl->dy2 < tl->by + tl->bh ? tl->dy2 : tl->by + tl->bh;
+        if (x1 < x2 && y1 < y2) {
+            XCopyArea(wm->display, tl->buffer, tl->window, wm->gc,
+                      x1 - tl->bx, y1 - tl->by, x2 - x1, y2 - y1, x1, y1);
+            presented = 1;
         }
-        
-        int cursor_y1 = 3;
-        int cursor_y2 = widget->height - 3;
-        
-        XDrawLine(wm->display, widget->window, wm->gc, 
-                 cursor_x, cursor_y1, cursor_x, cursor_y2);
+        tl->dx1 = tl->dx2 = 0;
     }
+    return presented;
 }
 
 void widget_manager_draw_all(WidgetManager* wm) {
     Widget* widget = wm->widgets;
     while (widget) {
+        widget->redraw_from = -1;
         widget_draw(wm, widget);
+        widget->dirty = 0;
         widget = widget->next;
     }
+    wm->dirty_count = 0;
+    widget_manager_present(wm);
+    XFlush(wm->display);
 }
 
-// Event handling
-void widget_manager_handle_event(WidgetManager* wm, XEvent* event) {
-    Widget* widget = widget_find_by_window(wm, event->xany.window);
+// Mark a widget for a full redraw on the next widget_manager_flush()
+void widget_invalidate(WidgetManager* wm, Widget* widget) {
     if (!widget) return;
+    widget->redraw_from = -1;
+    if (widget->dirty) return;
+    widget->dirty = 1;
+    wm->dirty_count++;
+}
+
+// Redraw only the widgets invalidated since the last flush. Nothing is sent
+// to the server here; the caller flushes, once for everything it drew.
+void widget_manager_flush(WidgetManager* wm) {
+    // Resizing a back buffer invalidates its widgets, so do it before drawing
+    for (WidgetToplevel* tl = wm->toplevels; tl; tl = tl->next) {
+        if (tl->stale) toplevel_layout(wm, tl);
+    }
+    
+    Widget* widget = wm->widgets;
+    while (widget && wm->dirty_count > 0) {
+        if (widget->dirty) {
+            widget_draw(wm, widget);
+            widget->dirty = 0;
+            wm->dirty_count--;
+        }
+        widget = widget->next;
+    }
+    widget_manager_present(wm);
+}
+
+// Move a widget within its toplevel
+void widget_move(WidgetManager* wm, Widget* widget, int x, int y) {
+    if (!widget || (widget->x == x && widget->y == y)) return;
     
+    if (widget->visible) {
+        XClearArea(wm->display, widget->window, widget->x, widget->y,
+                   widget->width + 2 * widget->border, widget->height + 2 * widget->border, False);
+    }
+    widget->x = x;
+    widget->y = y;
+    widget->toplevel->stale = 1;
+    widget_invalidate(wm, widget);
+}
+
+// Show or hide a widget; hidden widgets keep their place in the back buffer
+void widget_set_visible(WidgetManager* wm, Widget* widget, int visible) {
+    if (!widget || widget->visible == visible) return;
+    
+    widget->visible = visible;
+    if (visible) {
+        widget_invalidate(wm, widget);
+    } else {
+        XClearArea(wm->display, widget->window, widget->x, widget->y,
+                   widget->width + 2 * widget->border, widget->height + 2 * widget->border, False);
+    }
+}
+
+// Byte offset in a textbox closest to pixel x
+static int widget_textbox_hit(WidgetManager* wm, Widget* widget, int x) {
+    const char* text = widget_get_text(widget);
+    int pos = 0, width = 0;
+    
+    while (pos < widget->text_len) {
+        int n = 1;
+        while (pos + n < widget->text_len && (text[pos + n] & 0xC0) == 0x80) n++;
+        int w = widget_run_width(wm, widget, text + pos, n);
+        if (x < width + w / 2) break;
+        width += w;
+        pos += n;
+    }
+    return pos;
+}
+
+// Event handling; widget events arrive on their toplevel window
+int widget_manager_handle_event(WidgetManager* wm, XEvent* event) {
+    WidgetToplevel* tl = toplevel_find(wm, event->xany.window);
+    if (!tl) return 0;
+    
+    Widget* widget = NULL;
     switch (event->type) {
         case Expose:
-            if (event->xexpose.count == 0) {
-                widget_draw(wm, widget);
-            }
+            // The back buffer still holds the pixels; just present them again
+            toplevel_damage(tl, event->xexpose.x, event->xexpose.y,
+                            event->xexpose.width, event->xexpose.height);
             break;
             
         case ButtonPress:
-            if (event->xbutton.button == Button1) {
+            widget = widget_find_at(wm, tl->window, event->xbutton.x, event->xbutton.y);
+            if (widget && event->xbutton.button == Button1) {
                 if (widget->type == WIDGET_BUTTON) {
                     widget->pressed = 1;
-                    widget_draw(wm, widget);
+                    wm->pressed_widget = widget;
+                    widget_invalidate(wm, widget);
                 } else if (widget->type == WIDGET_TEXTBOX) {
                     widget_set_focus(wm, widget);
                     
                     // Calculate cursor position from click
-                    int click_x = event->xbutton.x - 5;
-                    int pos = 0;
-                    
-                    for (int i = 0; i <= widget->text_len; i++) {
-                        int text_width = XTextWidth(wm->font, widget->text, i);
-                        if (click_x <= text_width) {
-                            pos = i;
-                            break;
-                        }
-                        pos = i;
-                    }
-                    
-                    widget->cursor_pos = pos;
-                    widget_draw(wm, widget);
+                    int x = event->xbutton.x - widget->x - widget->border - 5;
+                    widget_textbox_set_cursor(wm, widget, widget_textbox_hit(wm, widget, x));
                 }
             }
             break;
             
         case ButtonRelease:
-            if (event->xbutton.button == Button1 && widget->type == WIDGET_BUTTON) {
+            widget = wm->pressed_widget;
+            if (widget && event->xbutton.button == Button1) {
                 widget->pressed = 0;
-                widget_draw(wm, widget);
+                wm->pressed_widget = NULL;
+                widget_invalidate(wm, widget);
                 
-                if (widget->callback) {
+                if (widget->callback &&
+                    widget_find_at(wm, tl->window, event->xbutton.x, event->xbutton.y) == widget) {
                     widget->callback(widget, widget->user_data);
                 }
             }
             break;
             
         case KeyPress:
-            if (widget->type == WIDGET_TEXTBOX && widget->focused) {
-                KeySym keysym;
-                char buffer[32];
-                int len = XLookupString(&event->xkey, buffer, sizeof(buffer), 
-                                      &keysym, NULL);
+            widget = wm->focused_widget;
+            if (widget && widget->toplevel == tl && widget->type == WIDGET_TEXTBOX) {
+                // Let the input method swallow compose sequences
+                if (widget->xic && XFilterEvent(event, widget->window)) {
+                    break;
+                }
+                
+                KeySym keysym = NoSymbol;
+                char buffer[64];
+                int len;
+                if (widget->xic) {
+                    Status status;
+                    len = Xutf8LookupString(widget->xic, &event->xkey, buffer, sizeof(buffer),
+                                            &keysym, &status);
+                    if (status == XBufferOverflow) len = 0;
+                } else {
+                    len = XLookupString(&event->xkey, buffer, sizeof(buffer), &keysym, NULL);
+                }
                 
                 switch (keysym) {
                     case XK_BackSpace:
-                        widget_textbox_delete_char(widget);
+                        widget_textbox_delete_char(wm, widget);
                         break;
                     case XK_Left:
-                        widget_textbox_move_cursor(widget, -1);
+                        widget_textbox_move_cursor(wm, widget, -1);
                         break;
                     case XK_Right:
-                        widget_textbox_move_cursor(widget, 1);
+                        widget_textbox_move_cursor(wm, widget, 1);
                         break;
                     case XK_Home:
-                        widget->cursor_pos = 0;
+                        widget_textbox_set_cursor(wm, widget, 0);
                         break;
                     case XK_End:
-                        widget->cursor_pos = widget->text_len;
+                        widget_textbox_set_cursor(wm, widget, widget->text_len);
                         break;
                     default:
-                        if (len > 0 && buffer[0] >= 32 && buffer[0] < 127) {
-                            widget_textbox_insert_char(widget, buffer[0]);
-                        }
+                        widget_textbox_insert(wm, widget, buffer, len);
                         break;
                 }
-                widget_draw(wm, widget);
             }
             break;
             
         case FocusOut:
-            if (widget->type == WIDGET_TEXTBOX) {
+            // Grabs and pointer-root bookkeeping do not take focus from the widget
+            if (event->xfocus.mode != NotifyNormal || event->xfocus.detail == NotifyPointer) {
+                break;
+            }
+            widget = wm->focused_widget;
+            if (widget && widget->toplevel == tl) {
                 widget->focused = 0;
+                if (widget->xic) XUnsetICFocus(widget->xic);
                 if (wm->focused_widget == widget) {
                     wm->focused_widget = NULL;
                 }
-                widget_draw(wm, widget);
+                widget_invalidate(wm, widget);
             }
             break;
     }
-}
\ No newline at end of file
+    
+    return 1;
+}
@@ -8,6 +8,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define WIDGET_HASH_SIZE 64
+
 // Widget types
 typedef enum {
     WIDGET_BUTTON,
@@ -17,25 +19,57 @@ typedef enum {
 
 // Forward declarations
 typedef struct Widget Widget;
+typedef struct WidgetToplevel WidgetToplevel;
 typedef struct WidgetManager WidgetManager;
 
 // Callback function type
 typedef void (*WidgetCallback)(Widget* widget, void* user_data);
 
-// Widget structure
+// Widget structure; widgets have no X window of their own and are
+// painted into the back buffer of the toplevel they were created in
 struct Widget {
     WidgetType type;
-    Window window;
+    Window window;      // the toplevel the widget lives in
+    WidgetToplevel* toplevel;
     int x, y, width, height;
+    int border;         // drawn outside width x height, like an X window border
+    int visible;
     char* text;
     int text_len;
     int max_text_len;
     int cursor_pos;
     int focused;
     int pressed;
+    int masked;
+    int dirty;
+    // Textbox gap buffer: bytes [0, gap_start) precede the cursor and
+    // [gap_end, capacity) follow it; text holds a flattened copy
+    char* gap;
+    int gap_start;
+    int gap_end;
+    int capacity;
+    int cursor_x;       // pixel offset of the cursor, -1 if unknown
+    int redraw_from;    // first byte to repaint, -1 for the whole widget
+    int redraw_x;       // pixel offset of redraw_from
+    int scroll_x;       // pixels of text scrolled off the left edge
+    XIC xic;
     WidgetCallback callback;
     void* user_data;
     Widget* next;
+    Widget* hash_next;
+};
+
+// One back buffer per toplevel window, covering the bounding box of its
+// widgets; changes are drawn there and presented with a single XCopyArea
+struct WidgetToplevel {
+    Window window;
+    Pixmap buffer;
+    int bx, by, bw, bh;         // buffer extent in window coordinates
+    int dx1, dy1, dx2, dy2;     // damaged area to present, empty if dx1 >= dx2
+    int stale;                  // widget geometry changed since the buffer was sized
+    int widget_count;
+    WidgetToplevel* next;
+    WidgetToplevel* hash_next;
 };
 
 // Widget manager structure
@@ -45,8 +79,14 @@ struct WidgetManager {
     Window root;
     GC gc;
     XFontStruct* font;
+    XFontSet fontset;
+    XIM xim;
     Widget* widgets;
+    WidgetToplevel* toplevels;
+    WidgetToplevel* buckets[WIDGET_HASH_SIZE];
     Widget* focused_widget;
+    Widget* pressed_widget;
+    int dirty_count;
     unsigned long bg_color;
     unsigned long fg_color;
     unsigned long focus_color;
@@ -56,8 +96,9 @@ struct WidgetManager {
 // Widget manager functions
 WidgetManager* widget_manager_create(Display* display);
 void widget_manager_destroy(WidgetManager* wm);
-void widget_manager_handle_event(WidgetManager* wm, XEvent* event);
+int widget_manager_handle_event(WidgetManager* wm, XEvent* event);
 void widget_manager_draw_all(WidgetManager* wm);
+void widget_manager_flush(WidgetManager* wm);
 
 // Widget creation functions
 Widget* widget_create_button(WidgetManager* wm, Window parent, int x, int y, 
@@ -74,12 +115,18 @@ void widget_set_text(Widget* widget, const char* text);
 const char* widget_get_text(Widget* widget);
 void widget_set_focus(WidgetManager* wm, Widget* widget);
 void widget_draw(WidgetManager* wm, Widget* widget);
+void widget_invalidate(WidgetManager* wm, Widget* widget);
+void widget_move(WidgetManager* wm, Widget* widget, int x, int y);
+void widget_set_visible(WidgetManager* wm, Widget* widget, int visible);
 
 // Internal helper functions
 void widget_add_to_manager(WidgetManager* wm, Widget* widget);
-Widget* widget_find_by_window(WidgetManager* wm, Window window);
-void widget_textbox_insert_char(Widget* widget, char c);
-void widget_textbox_delete_char(Widget* widget);
-void widget_textbox_move_cursor(Widget* widget, int direction);
+void widget_remove_from_manager(WidgetManager* wm, Widget* widget);
+Widget* widget_find_at(WidgetManager* wm, Window window, int x, int y);
+void widget_textbox_insert(WidgetManager* wm, Widget* widget, const char* s, int len);
+void widget_textbox_delete_char(WidgetManager* wm, Widget* widget);
+void widget_textbox_move_cursor(WidgetManager* wm, Widget* widget, int direction);
+void widget_textbox_set_cursor(WidgetManager* wm, Widget* widget, int pos);
+void widget_textbox_clear(WidgetManager* wm, Widget* widget);
 
 #endif // XLIB_WIDGETS_H
\ No newline at end of file